@@ -1,10 +1,36 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <math.h>
 #include <dirent.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/stat.h>
+#include <pthread.h>
+#include <time.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#else
+#include <io.h>
+#endif
+#include "imgFourier.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FFT_X86_SIMD 1 // kernels SSE2/AVX2/AVX-512 escolhidos em tempo de execução
+#include <immintrin.h>
+#endif
+
+// Entradas usadas só por main: compiladas como biblioteca
+// (IMGFOURIER_NO_MAIN), ficam sem uso de propósito
+#if defined(IMGFOURIER_NO_MAIN) && defined(__GNUC__)
+#define PROGRAM_ONLY __attribute__((unused))
+#else
+#define PROGRAM_ONLY
+#endif
 
 #define MAX_FILENAME_LENGTH 256
 #define M_PI 3.14159265358979323846 // valor de PI π
@@ -38,34 +64,258 @@ typedef struct {
     uint8_t red;
 } RGB;
 
+// Cabeçalho dos espectros .dat (little-endian, como os cabeçalhos BMP). Os
+// coeficientes começam em header_size, múltiplo de 64, e seguem linha por
+// linha, com as partes real e imaginária intercaladas
+typedef struct {
+    char magic[8];          // "IMGFSPEC"
+    uint16_t version;       // SPECTRUM_VERSION
+    uint16_t header_size;   // deslocamento até os coeficientes
+    uint32_t width;         // largura da imagem
+    uint32_t height;        // altura da imagem (linhas gravadas)
+    uint32_t columns;       // colunas gravadas por linha: width/2 + 1 ou width
+    uint8_t channel;        // CHANNEL_RED, CHANNEL_GREEN ou CHANNEL_BLUE
+    uint8_t layout;         // SPECTRUM_HALF ou SPECTRUM_FULL
+    uint8_t precision;      // SPECTRUM_FLOAT64, SPECTRUM_FLOAT32 ou SPECTRUM_FLOAT16
+    uint8_t reserved0;
+    double scale;           // valor gravado = coeficiente * scale
+    uint64_t payload_bytes; // bytes de coeficientes
+    uint8_t reserved[20];   // zeros, completam 64 bytes
+} SpectrumHeader;
+
+// Arquivo único de espectros (--archive): um ArchiveHeader, depois blocos de
+// índice e registros anexados na ordem em que ficam prontos, todos em
+// posições múltiplas de 64
+typedef struct {
+    char magic[8];          // "IMGFARCH"
+    uint32_t version;       // ARCHIVE_VERSION
+    uint32_t block_entries; // entradas por bloco de índice
+    uint64_t first_block;   // posição do primeiro bloco de índice (0 = nenhum)
+    uint8_t reserved[40];
+} ArchiveHeader;
+
+// Início de um bloco de índice, seguido de block_entries ArchiveEntry
+typedef struct {
+    char magic[8];       // "IMGFIDX"
+    uint64_t next_block; // posição do bloco seguinte (0 = último)
+    uint32_t first_key;  // chave da primeira entrada do bloco
+    uint8_t reserved[44];
+} ArchiveBlockHeader;
+
+// Entrada do índice da chave (imagem - 1) * 3 + canal
+typedef struct {
+    uint64_t offset;   // posição do registro (0 = vazia)
+    uint64_t size;     // bytes do registro
+    uint64_t checksum; // FNV-1a de offset e size: entradas rasgadas são ignoradas
+    uint64_t reserved;
+} ArchiveEntry;
+
+// Registro de um espectro, seguido do mesmo conteúdo de um .dat
+// (SpectrumHeader e coeficientes)
+typedef struct {
+    char magic[8];                    // "IMGFREC"
+    uint32_t image_index;
+    uint32_t channel;
+    uint64_t data_bytes;              // bytes do .dat que vem em seguida
+    uint8_t reserved[40];
+    char source[MAX_FILENAME_LENGTH]; // BMP de origem
+} ArchiveRecord;
+
 #pragma pack(pop) // retorna ao alinhamento anterior
 
-int image_index = 1; // Contador global para o índice das imagens
+// Precisão da FFT e dos planos de amostras. Compilar com
+// -DFFT_SINGLE_PRECISION troca double por float: cabem o dobro de elementos
+// em cada registrador SIMD e o tráfego de memória cai à metade, o que basta
+// para entradas de 8 bits por canal (--check-accuracy mede o erro). Os
+// arquivos de saída têm o mesmo formato nas duas precisões.
+// Os tipos são os de imgFourier.h.
+#ifdef FFT_SINGLE_PRECISION
+#define FFT_PRECISION_NAME "float32"
+#else
+#define FFT_PRECISION_NAME "float64"
+#endif
+
+typedef imgfourier_real fft_real;
+typedef ImgFourierComplex Complex;
+
+// Conjuntos de instruções dos kernels da FFT, do mais simples ao mais largo
+enum {
+    SIMD_SCALAR,
+    SIMD_SSE2,
+    SIMD_AVX2,
+    SIMD_AVX512
+};
+
+// Formatos dos coeficientes no .dat
+enum {
+    SPECTRUM_FLOAT64, // double, como Complex na memória
+    SPECTRUM_FLOAT32,
+    SPECTRUM_FLOAT16, // meia precisão IEEE, com scale = 1 / (width * height)
+    SPECTRUM_RAW      // Complex sem cabeçalho (formato anterior)
+};
+
+// Opções de linha de comando
+typedef struct {
+    int full_spectrum; // grava o espectro completo em vez de só a metade não redundante
+    int pack_channels; // transforma vermelho e verde juntos numa única FFT complexa
+    int simd_level;    // maior conjunto de instruções permitido (--simd)
+    int jobs;          // threads calculando e threads gravando imagens em paralelo (-j)
+    int threads;       // threads dividindo a FFT de cada imagem (-t)
+    int channel_bmps;  // grava as prévias de cada canal em output_channels
+    size_t memory_budget;    // bytes de buffers do processo; imagens que não cabem são processadas em disco (0 = sem limite)
+    const char *scratch_dir; // diretório dos arquivos temporários do modo fora da memória
+    int txt_precision;       // casas decimais do .txt (-1 = menor representação exata)
+    int dat_format;          // SPECTRUM_FLOAT64, _FLOAT32, _FLOAT16 ou _RAW (--dat-format)
+    const char *archive_path; // arquivo único que recebe todos os espectros (--archive)
+    int queue_depth;          // imagens em andamento no pipeline (0 = jobs + 2)
+    int bench;                // mede os estágios com imagens sintéticas em vez de processar img (--bench)
+    const char *bench_sizes;  // tamanhos medidos, "LxA,LxA,..." (NULL = BENCH_DEFAULT_SIZES)
+    int bench_repeat;         // medições de cada estágio; vale a menor
+    const char *bench_output; // resultados em JSON lines
+    int stats;                // mede as etapas de cada imagem e resume o lote no fim (--stats)
+    const char *metrics_path; // medições em JSON lines, uma linha por imagem e uma do lote (--metrics)
+    int check_accuracy;       // compara a FFT com uma DFT direta e sai (--check-accuracy)
+    const char *wisdom_path;  // estratégias do autoajuste, lidas no início e gravadas no fim (--wisdom)
+    const char *manifest_path; // hashes das entradas já processadas, para pular as inalteradas (--manifest)
+    int spectrum_bmp;          // grava só a imagem do espectro, em output_spectrum (--spectrum-bmp)
+} Options;
+
+static Options options = {0, 0, SIMD_AVX512, 1, 1, 1, 0, ".", -1, SPECTRUM_FLOAT64, NULL, 0, 0, NULL, 3, "bench.jsonl", 0, NULL, 0,
+                   NULL, NULL, 0};
+
+// Kernels radix-4 sobre vetores separados de partes reais e imaginárias (SoA).
+// Um passo processa blocos de 4h elementos: funde os estágios radix-2 de
+// tamanho 2h (fator w1) e 4h (fator w2); tw traz w1r, w1i, w2r, w2i, h de cada.
+// O mesmo corpo é instanciado para cada conjunto de instruções; WIDTH é o
+// número de fft_real por registrador e precisa dividir h.
+#define DEFINE_RADIX4_PASS(NAME, TARGET, VEC, WIDTH, LOAD, STORE, ADD, SUB, MUL)         \
+    TARGET static void NAME(fft_real *re, fft_real *im, int n, int h, const fft_real *tw) { \
+        const fft_real *w1r = tw;                                                        \
+        const fft_real *w1i = tw + h;                                                    \
+        const fft_real *w2r = tw + 2 * h;                                                \
+        const fft_real *w2i = tw + 3 * h;                                                \
+        for (int base = 0; base < n; base += 4 * h) {                                    \
+            fft_real *ar = re + base, *ai = im + base;                                   \
+            fft_real *br = ar + h, *bi = ai + h;                                         \
+            fft_real *cr = br + h, *ci = bi + h;                                         \
+            fft_real *dr = cr + h, *di = ci + h;                                         \
+            for (int j = 0; j < h; j += WIDTH) {                                         \
+                VEC xw1r = LOAD(w1r + j), xw1i = LOAD(w1i + j);                          \
+                VEC xw2r = LOAD(w2r + j), xw2i = LOAD(w2i + j);                          \
+                VEC xar = LOAD(ar + j), xai = LOAD(ai + j);                              \
+                VEC xbr = LOAD(br + j), xbi = LOAD(bi + j);                              \
+                VEC xcr = LOAD(cr + j), xci = LOAD(ci + j);                              \
+                VEC xdr = LOAD(dr + j), xdi = LOAD(di + j);                              \
+                /* primeiro estágio radix-2 (tamanho 2h) */                              \
+                VEC wbr = SUB(MUL(xw1r, xbr), MUL(xw1i, xbi));                           \
+                VEC wbi = ADD(MUL(xw1r, xbi), MUL(xw1i, xbr));                           \
+                VEC wdr = SUB(MUL(xw1r, xdr), MUL(xw1i, xdi));                           \
+                VEC wdi = ADD(MUL(xw1r, xdi), MUL(xw1i, xdr));                           \
+                VEC a1r = ADD(xar, wbr), a1i = ADD(xai, wbi);                            \
+                VEC b1r = SUB(xar, wbr), b1i = SUB(xai, wbi);                            \
+                VEC c1r = ADD(xcr, wdr), c1i = ADD(xci, wdi);                            \
+                VEC d1r = SUB(xcr, wdr), d1i = SUB(xci, wdi);                            \
+                /* segundo estágio (tamanho 4h); W_{4h}^{j+h} = -i * w2 */               \
+                VEC wcr = SUB(MUL(xw2r, c1r), MUL(xw2i, c1i));                           \
+                VEC wci = ADD(MUL(xw2r, c1i), MUL(xw2i, c1r));                           \
+                VEC wer = SUB(MUL(xw2r, d1r), MUL(xw2i, d1i));                           \
+                VEC wei = ADD(MUL(xw2r, d1i), MUL(xw2i, d1r));                           \
+                STORE(ar + j, ADD(a1r, wcr));                                            \
+                STORE(ai + j, ADD(a1i, wci));                                            \
+                STORE(cr + j, SUB(a1r, wcr));                                            \
+                STORE(ci + j, SUB(a1i, wci));                                            \
+                STORE(br + j, ADD(b1r, wei));                                            \
+                STORE(bi + j, SUB(b1i, wer));                                            \
+                STORE(dr + j, SUB(b1r, wei));                                            \
+                STORE(di + j, ADD(b1i, wer));                                            \
+            }                                                                            \
+        }                                                                                \
+    }
+
+#define SCALAR_LOAD(p) (*(p))
+#define SCALAR_STORE(p, v) (*(p) = (v))
+#define SCALAR_ADD(a, b) ((a) + (b))
+#define SCALAR_SUB(a, b) ((a) - (b))
+#define SCALAR_MUL(a, b) ((a) * (b))
+
+DEFINE_RADIX4_PASS(radix4_pass_scalar, , fft_real, 1,
+                   SCALAR_LOAD, SCALAR_STORE, SCALAR_ADD, SCALAR_SUB, SCALAR_MUL)
+
+#if defined(FFT_X86_SIMD) && defined(FFT_SINGLE_PRECISION)
+DEFINE_RADIX4_PASS(radix4_pass_sse2, __attribute__((target("sse2"))), __m128, 4,
+                   _mm_loadu_ps, _mm_storeu_ps, _mm_add_ps, _mm_sub_ps, _mm_mul_ps)
+DEFINE_RADIX4_PASS(radix4_pass_avx2, __attribute__((target("avx2,fma"))), __m256, 8,
+                   _mm256_loadu_ps, _mm256_storeu_ps, _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps)
+DEFINE_RADIX4_PASS(radix4_pass_avx512, __attribute__((target("avx512f"))), __m512, 16,
+                   _mm512_loadu_ps, _mm512_storeu_ps, _mm512_add_ps, _mm512_sub_ps, _mm512_mul_ps)
+#elif defined(FFT_X86_SIMD)
+DEFINE_RADIX4_PASS(radix4_pass_sse2, __attribute__((target("sse2"))), __m128d, 2,
+                   _mm_loadu_pd, _mm_storeu_pd, _mm_add_pd, _mm_sub_pd, _mm_mul_pd)
+DEFINE_RADIX4_PASS(radix4_pass_avx2, __attribute__((target("avx2,fma"))), __m256d, 4,
+                   _mm256_loadu_pd, _mm256_storeu_pd, _mm256_add_pd, _mm256_sub_pd, _mm256_mul_pd)
+DEFINE_RADIX4_PASS(radix4_pass_avx512, __attribute__((target("avx512f"))), __m512d, 8,
+                   _mm512_loadu_pd, _mm512_storeu_pd, _mm512_add_pd, _mm512_sub_pd, _mm512_mul_pd)
+#endif
 
 typedef struct {
-    double real;
-    double imag;
-} Complex;
+    const char *name;
+    int width; // fft_real por registrador
+    void (*pass)(fft_real *re, fft_real *im, int n, int h, const fft_real *tw);
+} Radix4Kernel;
+
+static const Radix4Kernel radix4_kernels[] = {
+    {"scalar", 1, radix4_pass_scalar},
+#ifdef FFT_X86_SIMD
+    {"sse2", 16 / sizeof(fft_real), radix4_pass_sse2},
+    {"avx2", 32 / sizeof(fft_real), radix4_pass_avx2},
+    {"avx512", 64 / sizeof(fft_real), radix4_pass_avx512},
+#endif
+};
 
-void ensure_directory_exists(const char *dir) {
+// Escolhe o kernel mais largo suportado pela CPU (cpuid) e permitido por --simd
+static const Radix4Kernel *select_radix4_kernel(void) {
+    int level = SIMD_SCALAR;
+#ifdef FFT_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        level = SIMD_SSE2;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        level = SIMD_AVX2;
+    }
+    if (__builtin_cpu_supports("avx512f")) {
+        level = SIMD_AVX512;
+    }
+#endif
+    if (level > options.simd_level) {
+        level = options.simd_level;
+    }
+    return &radix4_kernels[level];
+}
+
+static void ensure_directory_exists(const char *dir) {
     struct stat st = {0};
     if (stat(dir, &st) == -1) {
+#ifdef _WIN32
         mkdir(dir);
+#else
+        mkdir(dir, 0777);
+#endif
     }
 }
 
-void write_bmp(const char *filename, RGB *pixels, int width, int height) {
+// Bytes de uma linha BMP: as linhas são alinhadas em múltiplos de 4 bytes
+static size_t bmp_stride(int width, int bits_per_pixel) {
+    return (((size_t)width * bits_per_pixel + 31) / 32) * 4;
+}
+
+static void write_bmp_headers(FILE *fp, int width, int height) {
     BITMAPFILEHEADER bfh;
     BITMAPINFOHEADER bih;
-    FILE *fp = fopen(filename, "wb");
-    if (!fp) {
-        perror("Erro ao criar arquivo BMP");
-        return;
-    }
 
     // preencher cabeçalho do arquivo BMP
     bfh.bfType = 0x4D42; // 'BM'
-    bfh.bfSize = sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER) + width * height * sizeof(RGB);
+    bfh.bfSize = sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER) + bmp_stride(width, 24) * height;
     bfh.bfReserved1 = 0;
     bfh.bfReserved2 = 0;
     bfh.bfOffBits = sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER);
@@ -86,205 +336,5834 @@ void write_bmp(const char *filename, RGB *pixels, int width, int height) {
     // escrever cabeçalhos
     fwrite(&bfh, sizeof(BITMAPFILEHEADER), 1, fp);
     fwrite(&bih, sizeof(BITMAPINFOHEADER), 1, fp);
-    fwrite(pixels, sizeof(RGB), width * height, fp);
+}
+
+static void write_bmp(const char *filename, RGB *pixels, int width, int height) {
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) {
+        perror("Erro ao criar arquivo BMP");
+        return;
+    }
+
+    write_bmp_headers(fp, width, height);
+    static const uint8_t padding[3] = {0, 0, 0};
+    size_t pad = bmp_stride(width, 24) - (size_t)width * sizeof(RGB);
+    for (int y = 0; y < height; y++) {
+        fwrite(pixels + (size_t)y * width, sizeof(RGB), width, fp);
+        fwrite(padding, 1, pad, fp);
+    }
 
     fclose(fp);
 }
 
-// FFT = Fast Fourier Transform
-void fft(Complex *x, int N) {
-    if (N <= 1) return;
+// Canais de cor, na ordem dos planos de entrada da FFT
+enum {
+    CHANNEL_RED,
+    CHANNEL_GREEN,
+    CHANNEL_BLUE
+};
 
-    Complex *even = (Complex *)malloc(N / 2 * sizeof(Complex));
-    Complex *odd = (Complex *)malloc(N / 2 * sizeof(Complex));
-    for (int i = 0; i < N / 2; i++) {
-        even[i] = x[i * 2];
-        odd[i] = x[i * 2 + 1];
-    }
+#define BMP_CHUNK_PIXELS 1024 // pixels montados por vez na prévia de um canal
 
-    fft(even, N / 2);
-    fft(odd, N / 2);
+// Grava uma linha da prévia de um canal (só aquele componente, os demais
+// zerados) direto das amostras, em blocos, sem montar a imagem RGB inteira
+static void write_channel_row(FILE *fp, const fft_real *row, int channel, int width) {
+    static const uint8_t padding[3] = {0, 0, 0};
+    size_t pad = bmp_stride(width, 24) - (size_t)width * sizeof(RGB);
+    RGB chunk[BMP_CHUNK_PIXELS];
+    for (int x = 0; x < width; x += BMP_CHUNK_PIXELS) {
+        int count = width - x < BMP_CHUNK_PIXELS ? width - x : BMP_CHUNK_PIXELS;
+        memset(chunk, 0, count * sizeof(RGB));
+        for (int k = 0; k < count; k++) {
+            uint8_t value = (uint8_t)row[x + k];
+            switch (channel) {
+            case CHANNEL_RED:
+                chunk[k].red = value;
+                break;
+            case CHANNEL_GREEN:
+                chunk[k].green = value;
+                break;
+            case CHANNEL_BLUE:
+                chunk[k].blue = value;
+                break;
+            }
+        }
+        fwrite(chunk, sizeof(RGB), count, fp);
+    }
+    fwrite(padding, 1, pad, fp);
+}
 
-    for (int k = 0; k < N / 2; k++) {
-        double t = -2.0 * M_PI * k / N;
-        Complex exp = {cos(t), sin(t)};
-        Complex temp = {exp.real * odd[k].real - exp.imag * odd[k].imag, exp.real * odd[k].imag + exp.imag * odd[k].real};
-        x[k].real = even[k].real + temp.real;
-        x[k].imag = even[k].imag + temp.imag;
-        x[k + N / 2].real = even[k].real - temp.real;
-        x[k + N / 2].imag = even[k].imag - temp.imag;
+// Cria o arquivo da prévia de um canal; as linhas são gravadas depois, de baixo para cima
+static FILE *open_channel_bmp(const char *filename, int width, int height) {
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) {
+        perror("Erro ao criar arquivo BMP");
+        return NULL;
     }
+    write_bmp_headers(fp, width, height);
+    return fp;
+}
 
-    free(even);
-    free(odd);
+// Grava a prévia de um canal a partir do plano de amostras inteiro
+static void write_channel_bmp(const char *filename, const fft_real *plane, int channel, int width, int height) {
+    FILE *fp = open_channel_bmp(filename, width, height);
+    if (!fp) {
+        return;
+    }
+    for (int y = 0; y < height; y++) {
+        write_channel_row(fp, plane + (size_t)y * width, channel, width);
+    }
+    fclose(fp);
 }
 
-void save_fft_to_txt(const char *filename, Complex *fft_result, int N) {
-    FILE *fp = fopen(filename, "w");
-    if (fp) {
-        for (int i = 0; i < N; i++) {
-            fprintf(fp, "%lf %lf\n", fft_result[i].real, fft_result[i].imag);
+// Grava os três planos como um BMP colorido, arredondando e saturando em 0..255
+static void write_rgb_planes_bmp(const char *filename, fft_real *const *planes, int width, int height) {
+    FILE *fp = open_channel_bmp(filename, width, height);
+    if (!fp) {
+        return;
+    }
+    static const uint8_t padding[3] = {0, 0, 0};
+    size_t pad = bmp_stride(width, 24) - (size_t)width * sizeof(RGB);
+    RGB chunk[BMP_CHUNK_PIXELS];
+    for (int y = 0; y < height; y++) {
+        size_t offset = (size_t)y * width;
+        for (int x = 0; x < width; x += BMP_CHUNK_PIXELS) {
+            int count = width - x < BMP_CHUNK_PIXELS ? width - x : BMP_CHUNK_PIXELS;
+            for (int k = 0; k < count; k++) {
+                uint8_t *components[3] = {&chunk[k].red, &chunk[k].green, &chunk[k].blue};
+                for (int c = 0; c < 3; c++) {
+                    double value = planes[c][offset + x + k];
+                    *components[c] = value <= 0.0 ? 0 : value >= 255.0 ? 255 : (uint8_t)lrint(value);
+                }
+            }
+            fwrite(chunk, sizeof(RGB), count, fp);
         }
-        printf("Gerando arquivo txt do arquivo : %s\n", filename);
+        fwrite(padding, 1, pad, fp);
+    }
+    fclose(fp);
+}
+
+#define BI_RGB 0       // sem compressão
+#define BI_BITFIELDS 3 // máscaras de cor explícitas (aceitas só no layout BGRA padrão)
+
+// BMP mapeado em memória: as linhas são lidas direto do arquivo mapeado, sem
+// cópia, e só as páginas tocadas são carregadas
+typedef struct {
+    int width;
+    int height;            // sempre positivo
+    int bits_per_pixel;    // 8, 24 ou 32
+    int top_down;          // biHeight negativo: primeira linha do arquivo é a de cima
+    size_t stride;         // bytes por linha, com padding
+    const uint8_t *pixels; // início dos dados (bfOffBits)
+    const uint8_t *palette; // entradas BGRA (8 bpp)
+    int palette_size;
+    uint8_t *data;         // arquivo inteiro (mapeado ou lido)
+    size_t size;
+    int borrowed;          // data pertence a quem chamou bmp_open_memory
+} BmpImage;
+
+static uint32_t read_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static int map_file(const char *filename, BmpImage *img) {
+#ifndef _WIN32
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        // arquivo vazio: rejeitado na validação dos cabeçalhos
+        close(fd);
+        return 0;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    img->data = map;
+    img->size = st.st_size;
+    return 0;
+#else
+    // sem mmap: lê o arquivo inteiro
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (size <= 0) {
         fclose(fp);
-    } else {
-        perror("Erro ao criar arquivo TXT");
+        return 0;
+    }
+    img->data = malloc(size);
+    if (!img->data || fread(img->data, 1, size, fp) != (size_t)size) {
+        free(img->data);
+        img->data = NULL;
+        fclose(fp);
+        return -1;
     }
+    fclose(fp);
+    img->size = size;
+    return 0;
+#endif
 }
 
-void apply_fft(RGB *channel, int width, int height, const char *dat_filename, const char *txt_filename) {
-    int N = width * height;
-    Complex *fft_result = (Complex *)malloc(N * sizeof(Complex));
+static void bmp_close(BmpImage *img) {
+    if (img->data && !img->borrowed) {
+#ifndef _WIN32
+        munmap(img->data, img->size);
+#else
+        free(img->data);
+#endif
+        img->data = NULL;
+    }
+}
 
-    for (int i = 0; i < N; i++) {
-        fft_result[i].real = channel[i].red; 
-        fft_result[i].imag = 0.0;
+// Valida um BMP (8 bpp com paleta, 24 ou 32 bpp, sem compressão, de baixo
+// para cima ou de cima para baixo) cujo conteúdo está em img->data. Os
+// cabeçalhos são conferidos contra o tamanho antes de qualquer acesso aos
+// pixels.
+static int bmp_parse(BmpImage *img, const char *filename) {
+    const char *error = NULL;
+    BITMAPFILEHEADER bfh;
+    BITMAPINFOHEADER bih;
+    if (img->size < sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER)) {
+        error = "arquivo menor que os cabecalhos";
+        goto fail;
     }
+    memcpy(&bfh, img->data, sizeof(BITMAPFILEHEADER));
+    memcpy(&bih, img->data + sizeof(BITMAPFILEHEADER), sizeof(BITMAPINFOHEADER));
 
-    fft(fft_result, N);
+    if (bfh.bfType != 0x4D42) {
+        error = "assinatura 'BM' ausente";
+        goto fail;
+    }
+    if (bih.biSize < sizeof(BITMAPINFOHEADER) || sizeof(BITMAPFILEHEADER) + (size_t)bih.biSize > img->size) {
+        error = "cabecalho de informacoes invalido";
+        goto fail;
+    }
+    if (bih.biWidth <= 0 || bih.biHeight == 0 || bih.biHeight == INT32_MIN || bih.biPlanes != 1) {
+        error = "dimensoes invalidas";
+        goto fail;
+    }
+    if (bih.biBitCount != 8 && bih.biBitCount != 24 && bih.biBitCount != 32) {
+        error = "profundidade de cor nao suportada (use 8, 24 ou 32 bpp)";
+        goto fail;
+    }
 
-    FILE *fp = fopen(dat_filename, "wb");
-    if (fp) {
-        fwrite(fft_result, sizeof(Complex), N, fp);
-        fclose(fp);
+    if (bih.biCompression == BI_BITFIELDS && bih.biBitCount == 32) {
+        // as máscaras ficam no próprio cabeçalho (V4/V5) ou logo depois dele
+        size_t masks = sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER);
+        if (masks + 12 > img->size ||
+            read_u32(img->data + masks) != 0x00FF0000 ||
+            read_u32(img->data + masks + 4) != 0x0000FF00 ||
+            read_u32(img->data + masks + 8) != 0x000000FF) {
+            error = "mascaras de cor nao suportadas";
+            goto fail;
+        }
+    } else if (bih.biCompression != BI_RGB) {
+        error = "compressao nao suportada";
+        goto fail;
+    }
+
+    img->width = bih.biWidth;
+    img->top_down = bih.biHeight < 0;
+    img->height = img->top_down ? -bih.biHeight : bih.biHeight;
+    img->bits_per_pixel = bih.biBitCount;
+    img->stride = bmp_stride(img->width, img->bits_per_pixel);
+
+    if ((uint64_t)img->width * img->height > INT32_MAX) {
+        error = "imagem grande demais";
+        goto fail;
+    }
+    if (bfh.bfOffBits > img->size || (uint64_t)img->stride * img->height > img->size - bfh.bfOffBits) {
+        error = "dados de pixel truncados";
+        goto fail;
+    }
+    img->pixels = img->data + bfh.bfOffBits;
+
+    if (img->bits_per_pixel == 8) {
+        size_t offset = sizeof(BITMAPFILEHEADER) + bih.biSize;
+        img->palette_size = bih.biClrUsed ? (int)bih.biClrUsed : 256;
+        if (img->palette_size > 256 || offset + 4 * (size_t)img->palette_size > bfh.bfOffBits) {
+            error = "paleta invalida";
+            goto fail;
+        }
+        img->palette = img->data + offset;
     }
+    return 0;
 
-    save_fft_to_txt(txt_filename, fft_result, N);
-    free(fft_result);
+fail:
+    fprintf(stderr, "BMP invalido (%s): %s\n", error, filename);
+    bmp_close(img);
+    return -1;
 }
 
-void extract_channels(const char *input_file) {
-    FILE *fp = fopen(input_file, "rb");
-    if (!fp) {
+static int bmp_open(const char *filename, BmpImage *img) {
+    memset(img, 0, sizeof(BmpImage));
+    if (map_file(filename, img) != 0) {
         perror("Erro ao abrir arquivo BMP");
-        return;
+        return -1;
     }
+    return bmp_parse(img, filename);
+}
 
-    BITMAPFILEHEADER bfh;
-    BITMAPINFOHEADER bih;
+// BMP já na memória; data só é lido e continua pertencendo a quem chama
+static int bmp_open_memory(const void *data, size_t size, BmpImage *img) {
+    memset(img, 0, sizeof(BmpImage));
+    img->data = (uint8_t *)data;
+    img->size = size;
+    img->borrowed = 1;
+    return bmp_parse(img, "(memoria)");
+}
 
-    if (fread(&bfh, sizeof(BITMAPFILEHEADER), 1, fp) != 1) {
-        perror("Erro ao ler cabeçalho do arquivo BMP");
-        fclose(fp);
-        return;
+// Linha y contada de baixo para cima, qualquer que seja a ordem no arquivo
+static const uint8_t *bmp_row(const BmpImage *img, int y) {
+    int file_row = img->top_down ? img->height - 1 - y : y;
+    return img->pixels + (size_t)file_row * img->stride;
+}
+
+// Decodifica uma linha em amostras de vermelho, verde e azul
+static void bmp_decode_row(const BmpImage *img, int y, fft_real *red, fft_real *green, fft_real *blue) {
+    const uint8_t *row = bmp_row(img, y);
+    switch (img->bits_per_pixel) {
+    case 24:
+        for (int x = 0; x < img->width; x++) {
+            blue[x] = row[3 * x];
+            green[x] = row[3 * x + 1];
+            red[x] = row[3 * x + 2];
+        }
+        break;
+    case 32:
+        for (int x = 0; x < img->width; x++) {
+            blue[x] = row[4 * x];
+            green[x] = row[4 * x + 1];
+            red[x] = row[4 * x + 2];
+        }
+        break;
+    case 8:
+        for (int x = 0; x < img->width; x++) {
+            // índices fora da paleta viram preto
+            const uint8_t *entry = row[x] < img->palette_size ? img->palette + 4 * row[x] : NULL;
+            blue[x] = entry ? entry[0] : 0;
+            green[x] = entry ? entry[1] : 0;
+            red[x] = entry ? entry[2] : 0;
+        }
+        break;
     }
+}
 
-    if (fread(&bih, sizeof(BITMAPINFOHEADER), 1, fp) != 1) {
-        perror("Erro ao ler cabeçalho de informações do BMP");
-        fclose(fp);
+// Devolve ao sistema as páginas do mapeamento das linhas [first, last) já
+// decodificadas, para que a leitura em faixas não acumule a imagem inteira
+// na memória residente
+static void bmp_release_rows(const BmpImage *img, int first, int last) {
+#ifndef _WIN32
+    if (first >= last || img->borrowed) {
         return;
     }
+    const uint8_t *a = bmp_row(img, first);
+    const uint8_t *b = bmp_row(img, last - 1);
+    const uint8_t *begin = a < b ? a : b;
+    const uint8_t *end = (a < b ? b : a) + img->stride;
 
-    int width = bih.biWidth;
-    int height = bih.biHeight;
-    RGB *pixels = malloc(width * height * sizeof(RGB));
-    if (!pixels) {
-        perror("Erro ao alocar memoria.");
-        fclose(fp);
-        return;
+    // só páginas inteiramente dentro das linhas: as vizinhas ainda podem ser lidas
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t lo = ((uintptr_t)begin + page - 1) & ~(page - 1);
+    uintptr_t hi = (uintptr_t)end & ~(page - 1);
+    if (lo < hi) {
+        madvise((void *)lo, hi - lo, MADV_DONTNEED);
     }
+#else
+    (void)img;
+    (void)first;
+    (void)last;
+#endif
+}
 
-    fread(pixels, sizeof(RGB), width * height, fp);
-    fclose(fp);
+// FFT = Fast Fourier Transform
 
-    RGB *red_channel = malloc(width * height * sizeof(RGB));
-    RGB *green_channel = malloc(width * height * sizeof(RGB));
-    RGB *blue_channel = malloc(width * height * sizeof(RGB));
+#define MAX_FFT_FACTORS 32 // fatores de um tamanho radix misto
 
-    if (!red_channel || !green_channel || !blue_channel) {
-    perror("Erro ao alocar memoria para os canais.");
-    free(pixels);
-    free(red_channel);
-    free(green_channel);
-    free(blue_channel);
-    return;
+// Algoritmo escolhido para cada tamanho de transformada
+enum {
+    FFT_RADIX4,      // n potência de 2: radix-4 iterativo in-place
+    FFT_MIXED_RADIX, // n = 2^a 3^b 5^c 7^d: Stockham radix misto
+    FFT_BLUESTEIN,   // demais tamanhos: chirp-z sobre uma FFT potência de 2
+    FFT_REAL         // entrada real (r2c/c2r) sobre uma FFT complexa de n/2
+};
+
+// Plano de FFT: tabelas calculadas uma única vez por tamanho e reutilizadas
+// entre canais e imagens, de modo que a transformada não aloca memória nem
+// chama cos/sin.
+typedef struct FFTPlan {
+    int n;             // tamanho da transformada
+    int kind;          // FFT_RADIX4, FFT_MIXED_RADIX ou FFT_BLUESTEIN
+    size_t work_len;   // elementos de trabalho exigidos por fft_execute
+    int log2n;         // log2(n) (radix-4)
+    int *bitrev;       // permutação por inversão de bits (radix-4)
+    fft_real *soa_twiddles;         // w1r, w1i, w2r, w2i de cada passo (radix-4)
+    const Radix4Kernel *kernel;   // kernel SIMD dos passos radix-4
+    Complex *twiddles; // fatores de giro de cada estágio (radix misto, real)
+    int nfactors;                  // quantidade de estágios (radix misto)
+    int factors[MAX_FFT_FACTORS];  // radix de cada estágio (radix misto)
+    struct FFTPlan *sub; // FFT de tamanho m >= 2n-1 (Bluestein) ou n/2 (real)
+    Complex *chirp;      // exp(-i*pi*k^2/n) (Bluestein)
+    Complex *chirp_fft;  // FFT do chirp conjugado, já dividida por m (Bluestein)
+} FFTPlan;
+
+// Planos já calculados. Nunca são descartados antes de destroy_fft_plans,
+// pois outras threads podem estar executando qualquer um deles.
+static FFTPlan **plan_cache = NULL;
+static int plan_count = 0;
+static int plan_capacity = 0;
+static pthread_mutex_t plan_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int is_power_of_two(int n) {
+    return n > 0 && (n & (n - 1)) == 0;
+}
+
+// Decompõe n em fatores 4, 2, 3, 5 e 7; retorna 0 se sobrar outro primo
+static int factorize_small_primes(int n, int *factors, int *nfactors) {
+    static const int radices[] = {4, 2, 3, 5, 7};
+    int count = 0;
+    for (int i = 0; i < 5; i++) {
+        while (n % radices[i] == 0 && count < MAX_FFT_FACTORS) {
+            factors[count++] = radices[i];
+            n /= radices[i];
+        }
     }
+    *nfactors = count;
+    return n == 1;
+}
 
-    printf("Extraindo canais de cores do arquivo: %s\n", input_file);
-    for (int i = 0; i < width * height; i++) {
-        
-        red_channel[i].red = pixels[i].red;
-        red_channel[i].green = 0;
-        red_channel[i].blue = 0;
+// Sabedoria (--wisdom): algoritmo escolhido pelo autoajuste para cada tamanho
+// potência de 2, entre o radix-4 com cada kernel SIMD e o Stockham radix
+// misto. Tamanhos sem entrada usam o radix-4 com o kernel mais largo.
+#define MAX_WISDOM 256 // entradas de cada tabela da sabedoria
+
+typedef struct {
+    int n;
+    int kind;                   // FFT_RADIX4 ou FFT_MIXED_RADIX
+    const Radix4Kernel *kernel; // kernel dos passos radix-4
+} PlanWisdom;
 
-        
-        green_channel[i].red = 0;
-        green_channel[i].green = pixels[i].green;
-        green_channel[i].blue = 0;
+static pthread_mutex_t wisdom_lock = PTHREAD_MUTEX_INITIALIZER;
+static PlanWisdom plan_wisdom[MAX_WISDOM];
+static int plan_wisdom_count = 0;
+static int wisdom_dirty = 0; // há escolhas novas a gravar
 
-        
-        blue_channel[i].red = 0;
-        blue_channel[i].green = 0;
-        blue_channel[i].blue = pixels[i].blue;
+static int find_plan_wisdom(int n, PlanWisdom *choice) {
+    int found = 0;
+    pthread_mutex_lock(&wisdom_lock);
+    for (int i = 0; i < plan_wisdom_count && !found; i++) {
+        if (plan_wisdom[i].n == n) {
+            *choice = plan_wisdom[i];
+            found = 1;
+        }
     }
+    pthread_mutex_unlock(&wisdom_lock);
+    return found;
+}
 
-    char filename[MAX_FILENAME_LENGTH];
-    printf("Gerando .bmp do arquivo: %s\n", input_file);
-    
-    snprintf(filename, sizeof(filename), "output_channels/red_channel_%02d.bmp", image_index);
-    write_bmp(filename, red_channel, width, height);
-
-    
-    snprintf(filename, sizeof(filename), "output_channels/green_channel_%02d.bmp", image_index);
-    write_bmp(filename, green_channel, width, height);
-
-    
-    snprintf(filename, sizeof(filename), "output_channels/blue_channel_%02d.bmp", image_index);
-    write_bmp(filename, blue_channel, width, height);
-
-    printf("Gerando .DAT do arquivo: %s\n", input_file);
-   
-    snprintf(filename, sizeof(filename), "output_fft_DAT/red_channel_fft_%02d.dat", image_index);
-    char txt_filename[MAX_FILENAME_LENGTH];
-    snprintf(txt_filename, sizeof(txt_filename), "output_fft_TXT/red_channel_fft_%02d.txt", image_index);
-    apply_fft(red_channel, width, height, filename, txt_filename);
-    
-    
-    snprintf(filename, sizeof(filename), "output_fft_DAT/green_channel _fft_%02d.dat", image_index);
-    snprintf(txt_filename, sizeof(txt_filename), "output_fft_TXT/green_channel_fft_%02d.txt", image_index);
-    apply_fft(green_channel, width, height, filename, txt_filename);
-
-    
-    snprintf(filename, sizeof(filename), "output_fft_DAT/blue_channel_fft_%02d.dat", image_index);
-    snprintf(txt_filename, sizeof(txt_filename), "output_fft_TXT/blue_channel_fft_%02d.txt", image_index);
-    apply_fft(blue_channel, width, height, filename, txt_filename);
+static void add_plan_wisdom(const PlanWisdom *choice) {
+    pthread_mutex_lock(&wisdom_lock);
+    int i = 0;
+    while (i < plan_wisdom_count && plan_wisdom[i].n != choice->n) {
+        i++;
+    }
+    if (i < MAX_WISDOM) {
+        plan_wisdom[i] = *choice;
+        plan_wisdom_count += i == plan_wisdom_count;
+        wisdom_dirty = 1;
+    }
+    pthread_mutex_unlock(&wisdom_lock);
+}
 
-    free(pixels);
-    free(red_channel);
-    free(green_channel);
-    free(blue_channel);
+static FFTPlan *create_fft_plan(int n);
+static void destroy_fft_plan(FFTPlan *plan);
+static void fft_execute(const FFTPlan *plan, Complex *x, Complex *work);
+static void fft_execute_inverse(const FFTPlan *plan, Complex *x, Complex *work);
 
-    image_index++;
+static int init_radix4_plan(FFTPlan *plan) {
+    int n = plan->n;
+    plan->kind = FFT_RADIX4;
+    plan->work_len = n; // vetores de partes reais e imaginárias (2n fft_real)
+    if (!plan->kernel) {
+        plan->kernel = select_radix4_kernel();
+    }
+    plan->log2n = 0;
+    while ((1 << plan->log2n) < n) {
+        plan->log2n++;
+    }
+
+    // tabela de inversão de bits
+    plan->bitrev = malloc(n * sizeof(int));
+    // cada passo radix-4 com quarto de bloco h guarda 4*h valores; a soma
+    // de todos os passos nunca passa de 2n
+    plan->soa_twiddles = malloc((n > 1 ? 2 * n : 1) * sizeof(fft_real));
+    if (!plan->bitrev || !plan->soa_twiddles) {
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        int r = 0;
+        for (int b = 0; b < plan->log2n; b++) {
+            r |= ((i >> b) & 1) << (plan->log2n - 1 - b);
+        }
+        plan->bitrev[i] = r;
+    }
+
+    // um estágio radix-4 funde dois estágios radix-2 (tamanhos 2h e 4h):
+    // w1 = W_{2h}^j e w2 = W_{4h}^j, separados em partes reais e imaginárias
+    fft_real *tw = plan->soa_twiddles;
+    int h = (plan->log2n & 1) ? 2 : 1;
+    for (; 4 * h <= n; h *= 4) {
+        for (int j = 0; j < h; j++) {
+            double t1 = -2.0 * M_PI * j / (2 * h);
+            double t2 = -2.0 * M_PI * j / (4 * h);
+            tw[j] = cos(t1);
+            tw[h + j] = sin(t1);
+            tw[2 * h + j] = cos(t2);
+            tw[3 * h + j] = sin(t2);
+        }
+        tw += 4 * h;
+    }
+    return 0;
 }
 
-void process_images_in_directory(const char *directory) {
-    ensure_directory_exists("output_fft_DAT");
-    ensure_directory_exists("output_fft_TXT");
-    ensure_directory_exists("output_channels");
-    struct dirent *entry;
-    DIR *dp = opendir(directory);
+static int init_mixed_radix_plan(FFTPlan *plan) {
+    int n = plan->n;
+    plan->kind = FFT_MIXED_RADIX;
+    plan->work_len = n; // Stockham alterna entre x e o buffer de trabalho
 
-    if (dp == NULL) {
-        perror("Erro ao abrir diretório");
-        return;
+    // estágio s com radix p usa W^(r*k) para k < ns e 1 <= r < p,
+    // onde ns é o produto dos radices anteriores
+    size_t total = 0;
+    int ns = 1;
+    for (int s = 0; s < plan->nfactors; s++) {
+        total += (size_t)ns * (plan->factors[s] - 1);
+        ns *= plan->factors[s];
+    }
+    plan->twiddles = malloc((total > 0 ? total : 1) * sizeof(Complex));
+    if (!plan->twiddles) {
+        return -1;
     }
 
-    while ((entry = readdir(dp)) != NULL) {
-        if (entry->d_type == DT_REG && strstr(entry->d_name, ".bmp")) {
-            char input_file[MAX_FILENAME_LENGTH];
-            snprintf(input_file, sizeof(input_file), "%s/%s", directory, entry->d_name);
-            printf("Processando arquivo: %s\n", input_file);
-            extract_channels(input_file);
-        } else {
-            printf("Arquivo ignorado: %s\n", entry->d_name);
+    Complex *tw = plan->twiddles;
+    ns = 1;
+    for (int s = 0; s < plan->nfactors; s++) {
+        int p = plan->factors[s];
+        for (int k = 0; k < ns; k++) {
+            for (int r = 1; r < p; r++) {
+                double t = -2.0 * M_PI * (double)r * k / ((double)ns * p);
+                tw->real = cos(t);
+                tw->imag = sin(t);
+                tw++;
+            }
         }
+        ns *= p;
+    }
+    return 0;
+}
+
+static int init_bluestein_plan(FFTPlan *plan) {
+    int n = plan->n;
+    int m = 1;
+    while (m < 2 * n - 1) {
+        m <<= 1;
     }
+    plan->kind = FFT_BLUESTEIN;
 
-    closedir(dp);
+    plan->sub = create_fft_plan(m);
+    plan->chirp = malloc(n * sizeof(Complex));
+    plan->chirp_fft = malloc(m * sizeof(Complex));
+    if (!plan->sub || !plan->chirp || !plan->chirp_fft) {
+        return -1;
+    }
+    plan->work_len = m + plan->sub->work_len;
+
+    // k^2 reduzido módulo 2n mantém o ângulo pequeno e preciso
+    for (int k = 0; k < n; k++) {
+        long long k2 = ((long long)k * k) % (2LL * n);
+        double t = -M_PI * (double)k2 / n;
+        plan->chirp[k].real = cos(t);
+        plan->chirp[k].imag = sin(t);
+    }
+
+    // b[k] = conj(chirp[|k|]) com índices negativos dobrados no fim do vetor
+    Complex *b = plan->chirp_fft;
+    for (int k = 0; k < m; k++) {
+        b[k].real = 0.0;
+        b[k].imag = 0.0;
+    }
+    for (int k = 0; k < n; k++) {
+        b[k].real = plan->chirp[k].real;
+        b[k].imag = -plan->chirp[k].imag;
+        if (k > 0) {
+            b[m - k] = b[k];
+        }
+    }
+    Complex *sub_work = malloc(plan->sub->work_len * sizeof(Complex));
+    if (!sub_work) {
+        return -1;
+    }
+    fft_execute(plan->sub, b, sub_work);
+    free(sub_work);
+    for (int k = 0; k < m; k++) {
+        b[k].real /= m;
+        b[k].imag /= m;
+    }
+    return 0;
 }
 
-int main() {
-    process_images_in_directory("img");
+// Plano de n com o algoritmo de choice; kind só é respeitado para potências
+// de 2, os demais tamanhos têm um único algoritmo possível
+static FFTPlan *create_fft_plan_as(const PlanWisdom *choice) {
+    FFTPlan *plan = calloc(1, sizeof(FFTPlan));
+    if (!plan) {
+        return NULL;
+    }
+    int n = choice->n;
+    plan->n = n;
+    plan->kernel = choice->kernel;
+
+    int rc;
+    if (is_power_of_two(n) && choice->kind == FFT_RADIX4) {
+        rc = init_radix4_plan(plan);
+    } else if (factorize_small_primes(n, plan->factors, &plan->nfactors)) {
+        rc = init_mixed_radix_plan(plan);
+    } else {
+        rc = init_bluestein_plan(plan);
+    }
+
+    if (rc != 0) {
+        destroy_fft_plan(plan);
+        return NULL;
+    }
+    return plan;
+}
+
+static FFTPlan *create_fft_plan(int n) {
+    PlanWisdom choice = {n, FFT_RADIX4, NULL};
+    find_plan_wisdom(n, &choice);
+    return create_fft_plan_as(&choice);
+}
+
+// Plano para entrada real de tamanho n. Para n par, as amostras são empacotadas
+// como n/2 complexos (pares na parte real, ímpares na imaginária) e separadas
+// depois com W_n^k; para n ímpar usa-se a FFT complexa de n diretamente.
+static FFTPlan *create_real_fft_plan(int n) {
+    FFTPlan *plan = calloc(1, sizeof(FFTPlan));
+    if (!plan) {
+        return NULL;
+    }
+    plan->n = n;
+    plan->kind = FFT_REAL;
+
+    if (n % 2 == 0) {
+        int m = n / 2;
+        plan->sub = create_fft_plan(m);
+        plan->twiddles = malloc(m * sizeof(Complex));
+        if (!plan->sub || !plan->twiddles) {
+            destroy_fft_plan(plan);
+            return NULL;
+        }
+        for (int k = 0; k < m; k++) {
+            double t = -2.0 * M_PI * k / n;
+            plan->twiddles[k].real = cos(t);
+            plan->twiddles[k].imag = sin(t);
+        }
+        plan->work_len = plan->sub->work_len;
+    } else {
+        plan->sub = create_fft_plan(n);
+        if (!plan->sub) {
+            destroy_fft_plan(plan);
+            return NULL;
+        }
+        plan->work_len = n + plan->sub->work_len;
+    }
+    return plan;
+}
+
+static void destroy_fft_plan(FFTPlan *plan) {
+    if (plan) {
+        free(plan->bitrev);
+        free(plan->soa_twiddles);
+        free(plan->twiddles);
+        destroy_fft_plan(plan->sub);
+        free(plan->chirp);
+        free(plan->chirp_fft);
+        free(plan);
+    }
+}
+
+static FFTPlan *lookup_plan(int n, int real) {
+    FFTPlan *plan = NULL;
+    pthread_mutex_lock(&plan_lock);
+
+    for (int i = 0; i < plan_count; i++) {
+        if (plan_cache[i]->n == n && (plan_cache[i]->kind == FFT_REAL) == real) {
+            plan = plan_cache[i];
+            goto done;
+        }
+    }
+
+    if (n <= 0) {
+        fprintf(stderr, "Tamanho de FFT invalido: %d\n", n);
+        goto done;
+    }
+
+    if (plan_count == plan_capacity) {
+        int capacity = plan_capacity ? 2 * plan_capacity : 16;
+        FFTPlan **cache = realloc(plan_cache, capacity * sizeof(FFTPlan *));
+        if (!cache) {
+            perror("Erro ao alocar cache de planos");
+            goto done;
+        }
+        plan_cache = cache;
+        plan_capacity = capacity;
+    }
+
+    plan = real ? create_real_fft_plan(n) : create_fft_plan(n);
+    if (!plan) {
+        perror("Erro ao alocar plano de FFT");
+        goto done;
+    }
+    plan_cache[plan_count++] = plan;
+
+done:
+    pthread_mutex_unlock(&plan_lock);
+    return plan;
+}
+
+// Retorna o plano para o tamanho n, criando-o na primeira utilização
+static FFTPlan *get_fft_plan(int n) {
+    return lookup_plan(n, 0);
+}
+
+// Idem para transformadas de entrada real (fft_execute_r2c / fft_execute_c2r)
+static FFTPlan *get_real_fft_plan(int n) {
+    return lookup_plan(n, 1);
+}
+
+static void destroy_fft_plans(void) {
+    pthread_mutex_lock(&plan_lock);
+    for (int i = 0; i < plan_count; i++) {
+        destroy_fft_plan(plan_cache[i]);
+    }
+    free(plan_cache);
+    plan_cache = NULL;
+    plan_count = 0;
+    plan_capacity = 0;
+    pthread_mutex_unlock(&plan_lock);
+}
+
+// Transformada iterativa: a permutação por inversão de bits (fundida ao
+// primeiro estágio radix-2 quando log2(n) é ímpar) separa x em vetores de
+// partes reais e imaginárias no buffer de trabalho; os passos radix-4 rodam
+// no kernel SIMD do plano e o resultado volta intercalado para x.
+static void fft_radix4(const FFTPlan *plan, Complex *x, Complex *work) {
+    int n = plan->n;
+    fft_real *re = (fft_real *)work;
+    fft_real *im = re + n;
+    const int *bitrev = plan->bitrev;
+
+    int h = 1;
+    if (plan->log2n & 1) {
+        for (int i = 0; i < n; i += 2) {
+            Complex a = x[bitrev[i]];
+            Complex b = x[bitrev[i + 1]];
+            re[i] = a.real + b.real;
+            im[i] = a.imag + b.imag;
+            re[i + 1] = a.real - b.real;
+            im[i + 1] = a.imag - b.imag;
+        }
+        h = 2;
+    } else {
+        for (int i = 0; i < n; i++) {
+            re[i] = x[bitrev[i]].real;
+            im[i] = x[bitrev[i]].imag;
+        }
+    }
+
+    // passos com h menor que o registrador usam o kernel mais largo que cabe
+    // (a tabela de kernels está em ordem crescente de largura)
+    const fft_real *tw = plan->soa_twiddles;
+    for (; 4 * h <= n; h *= 4) {
+        const Radix4Kernel *kernel = plan->kernel;
+        while (kernel->width > h) {
+            kernel--;
+        }
+        kernel->pass(re, im, n, h, tw);
+        tw += 4 * h;
+    }
+
+    for (int i = 0; i < n; i++) {
+        x[i].real = re[i];
+        x[i].imag = im[i];
+    }
+}
+
+// DFT direta de p pontos (p = 2, 3, 4, 5 ou 7) usada nos estágios radix misto
+static void dft_small(Complex *v, int p) {
+    switch (p) {
+    case 2: {
+        Complex a = v[0];
+        v[0].real = a.real + v[1].real;
+        v[0].imag = a.imag + v[1].imag;
+        v[1].real = a.real - v[1].real;
+        v[1].imag = a.imag - v[1].imag;
+        break;
+    }
+    case 3: {
+        const fft_real s = 0.86602540378443864676; // sin(2*pi/3)
+        Complex t1 = {v[1].real + v[2].real, v[1].imag + v[2].imag};
+        Complex d = {v[1].real - v[2].real, v[1].imag - v[2].imag};
+        Complex t2 = {v[0].real - 0.5 * t1.real, v[0].imag - 0.5 * t1.imag};
+        Complex t3 = {s * d.imag, -s * d.real}; // -i * s * d
+        v[0].real += t1.real;
+        v[0].imag += t1.imag;
+        v[1].real = t2.real + t3.real;
+        v[1].imag = t2.imag + t3.imag;
+        v[2].real = t2.real - t3.real;
+        v[2].imag = t2.imag - t3.imag;
+        break;
+    }
+    case 4: {
+        Complex s02 = {v[0].real + v[2].real, v[0].imag + v[2].imag};
+        Complex d02 = {v[0].real - v[2].real, v[0].imag - v[2].imag};
+        Complex s13 = {v[1].real + v[3].real, v[1].imag + v[3].imag};
+        Complex d13 = {v[1].imag - v[3].imag, v[3].real - v[1].real}; // -i * (v1 - v3)
+        v[0].real = s02.real + s13.real;
+        v[0].imag = s02.imag + s13.imag;
+        v[2].real = s02.real - s13.real;
+        v[2].imag = s02.imag - s13.imag;
+        v[1].real = d02.real + d13.real;
+        v[1].imag = d02.imag + d13.imag;
+        v[3].real = d02.real - d13.real;
+        v[3].imag = d02.imag - d13.imag;
+        break;
+    }
+    case 5: {
+        const fft_real c1 = 0.30901699437494742410;  // cos(2*pi/5)
+        const fft_real c2 = -0.80901699437494742410; // cos(4*pi/5)
+        const fft_real s1 = 0.95105651629515357212;  // sin(2*pi/5)
+        const fft_real s2 = 0.58778525229247312917;  // sin(4*pi/5)
+        Complex a1 = {v[1].real + v[4].real, v[1].imag + v[4].imag};
+        Complex a2 = {v[2].real + v[3].real, v[2].imag + v[3].imag};
+        Complex b1 = {v[1].real - v[4].real, v[1].imag - v[4].imag};
+        Complex b2 = {v[2].real - v[3].real, v[2].imag - v[3].imag};
+        Complex t1 = {v[0].real + c1 * a1.real + c2 * a2.real, v[0].imag + c1 * a1.imag + c2 * a2.imag};
+        Complex t2 = {v[0].real + c2 * a1.real + c1 * a2.real, v[0].imag + c2 * a1.imag + c1 * a2.imag};
+        Complex u1 = {s1 * b1.real + s2 * b2.real, s1 * b1.imag + s2 * b2.imag};
+        Complex u2 = {s2 * b1.real - s1 * b2.real, s2 * b1.imag - s1 * b2.imag};
+        v[0].real += a1.real + a2.real;
+        v[0].imag += a1.imag + a2.imag;
+        v[1].real = t1.real + u1.imag; // t1 - i*u1
+        v[1].imag = t1.imag - u1.real;
+        v[4].real = t1.real - u1.imag; // t1 + i*u1
+        v[4].imag = t1.imag + u1.real;
+        v[2].real = t2.real + u2.imag;
+        v[2].imag = t2.imag - u2.real;
+        v[3].real = t2.real - u2.imag;
+        v[3].imag = t2.imag + u2.real;
+        break;
+    }
+    case 7: {
+        // cos e sin de 2*pi*m/7, m = 0..6
+        static const fft_real C[7] = {1.0, 0.62348980185873353053, -0.22252093395631440429, -0.90096886790241912624,
+                                    -0.90096886790241912624, -0.22252093395631440429, 0.62348980185873353053};
+        static const fft_real S[7] = {0.0, 0.78183148246802980871, 0.97492791218182360702, 0.43388373911755812048,
+                                    -0.43388373911755812048, -0.97492791218182360702, -0.78183148246802980871};
+        Complex a[4], b[4];
+        for (int r = 1; r <= 3; r++) {
+            a[r].real = v[r].real + v[7 - r].real;
+            a[r].imag = v[r].imag + v[7 - r].imag;
+            b[r].real = v[r].real - v[7 - r].real;
+            b[r].imag = v[r].imag - v[7 - r].imag;
+        }
+        Complex x0 = v[0];
+        v[0].real = x0.real + a[1].real + a[2].real + a[3].real;
+        v[0].imag = x0.imag + a[1].imag + a[2].imag + a[3].imag;
+        for (int k = 1; k <= 3; k++) {
+            Complex t = x0;
+            Complex u = {0.0, 0.0};
+            for (int r = 1; r <= 3; r++) {
+                int m = (r * k) % 7;
+                t.real += C[m] * a[r].real;
+                t.imag += C[m] * a[r].imag;
+                u.real += S[m] * b[r].real;
+                u.imag += S[m] * b[r].imag;
+            }
+            v[k].real = t.real + u.imag; // t - i*u
+            v[k].imag = t.imag - u.real;
+            v[7 - k].real = t.real - u.imag; // t + i*u
+            v[7 - k].imag = t.imag + u.real;
+        }
+        break;
+    }
+    }
+}
+
+// Stockham radix misto (autossort): cada estágio lê de um buffer e escreve
+// no outro já na ordem final, dispensando a inversão de dígitos
+static void fft_mixed_radix(const FFTPlan *plan, Complex *x, Complex *work) {
+    int n = plan->n;
+    Complex *in = x;
+    Complex *out = work;
+    const Complex *tw = plan->twiddles;
+    int ns = 1;
+
+    for (int s = 0; s < plan->nfactors; s++) {
+        int p = plan->factors[s];
+        int stride = n / p;
+        for (int blk = 0; blk < stride / ns; blk++) {
+            for (int k = 0; k < ns; k++) {
+                int j = blk * ns + k;
+                const Complex *w = tw + k * (p - 1);
+                Complex v[7];
+                v[0] = in[j];
+                for (int r = 1; r < p; r++) {
+                    Complex a = in[j + r * stride];
+                    v[r].real = a.real * w[r - 1].real - a.imag * w[r - 1].imag;
+                    v[r].imag = a.real * w[r - 1].imag + a.imag * w[r - 1].real;
+                }
+                dft_small(v, p);
+                Complex *dst = out + blk * ns * p + k;
+                for (int r = 0; r < p; r++) {
+                    dst[r * ns] = v[r];
+                }
+            }
+        }
+        tw += ns * (p - 1);
+        ns *= p;
+        Complex *tmp = in;
+        in = out;
+        out = tmp;
+    }
+
+    if (in != x) {
+        memcpy(x, in, n * sizeof(Complex));
+    }
+}
+
+// Bluestein: X[k] = chirp[k] * (a (*) conj(chirp))[k], com a[j] = x[j] * chirp[j];
+// a convolução circular é feita com FFTs potência de 2 de tamanho m
+static void fft_bluestein(const FFTPlan *plan, Complex *x, Complex *work) {
+    int n = plan->n;
+    int m = plan->sub->n;
+    const Complex *w = plan->chirp;
+    const Complex *b = plan->chirp_fft;
+
+    for (int k = 0; k < n; k++) {
+        work[k].real = x[k].real * w[k].real - x[k].imag * w[k].imag;
+        work[k].imag = x[k].real * w[k].imag + x[k].imag * w[k].real;
+    }
+    for (int k = n; k < m; k++) {
+        work[k].real = 0.0;
+        work[k].imag = 0.0;
+    }
+
+    Complex *sub_work = work + m;
+    fft_execute(plan->sub, work, sub_work);
+
+    // produto no domínio da frequência; a inversa é feita como conj(FFT(conj(.)))
+    for (int k = 0; k < m; k++) {
+        fft_real re = work[k].real * b[k].real - work[k].imag * b[k].imag;
+        fft_real im = work[k].real * b[k].imag + work[k].imag * b[k].real;
+        work[k].real = re;
+        work[k].imag = -im;
+    }
+
+    fft_execute(plan->sub, work, sub_work);
+
+    for (int k = 0; k < n; k++) {
+        fft_real re = work[k].real;
+        fft_real im = -work[k].imag;
+        x[k].real = re * w[k].real - im * w[k].imag;
+        x[k].imag = re * w[k].imag + im * w[k].real;
+    }
+}
+
+// Executa o plano sobre x (in-place). work precisa de plan->work_len elementos.
+static void fft_execute(const FFTPlan *plan, Complex *x, Complex *work) {
+    switch (plan->kind) {
+    case FFT_RADIX4:
+        fft_radix4(plan, x, work);
+        break;
+    case FFT_MIXED_RADIX:
+        fft_mixed_radix(plan, x, work);
+        break;
+    case FFT_BLUESTEIN:
+        fft_bluestein(plan, x, work);
+        break;
+    }
+}
+
+// Inversa não normalizada (resultado multiplicado por n), via conj(FFT(conj(x)))
+static void fft_execute_inverse(const FFTPlan *plan, Complex *x, Complex *work) {
+    for (int k = 0; k < plan->n; k++) {
+        x[k].imag = -x[k].imag;
+    }
+    fft_execute(plan, x, work);
+    for (int k = 0; k < plan->n; k++) {
+        x[k].imag = -x[k].imag;
+    }
+}
+
+// FFT real -> complexa: grava em out os n/2 + 1 coeficientes não redundantes
+// (os demais são conjugados destes). work precisa de plan->work_len elementos.
+static void fft_execute_r2c(const FFTPlan *plan, const fft_real *in, Complex *out, Complex *work) {
+    int n = plan->n;
+
+    if (n % 2 != 0) {
+        for (int k = 0; k < n; k++) {
+            work[k].real = in[k];
+            work[k].imag = 0.0;
+        }
+        fft_execute(plan->sub, work, work + n);
+        memcpy(out, work, (n / 2 + 1) * sizeof(Complex));
+        return;
+    }
+
+    int m = n / 2;
+    for (int k = 0; k < m; k++) {
+        out[k].real = in[2 * k];
+        out[k].imag = in[2 * k + 1];
+    }
+    fft_execute(plan->sub, out, work);
+
+    // separa os espectros das amostras pares (E) e ímpares (O) de Z = E + iO:
+    // X[k] = E[k] + W^k O[k] e X[m-k] = conj(E[k] - W^k O[k])
+    Complex z0 = out[0];
+    out[0].real = z0.real + z0.imag;
+    out[0].imag = 0.0;
+    out[m].real = z0.real - z0.imag;
+    out[m].imag = 0.0;
+
+    const Complex *w = plan->twiddles;
+    for (int k = 1; k <= m / 2; k++) {
+        Complex zk = out[k];
+        Complex zm = out[m - k];
+        Complex e = {0.5 * (zk.real + zm.real), 0.5 * (zk.imag - zm.imag)};
+        Complex o = {0.5 * (zk.imag + zm.imag), -0.5 * (zk.real - zm.real)};
+        Complex wo = {w[k].real * o.real - w[k].imag * o.imag, w[k].real * o.imag + w[k].imag * o.real};
+        out[k].real = e.real + wo.real;
+        out[k].imag = e.imag + wo.imag;
+        out[m - k].real = e.real - wo.real;
+        out[m - k].imag = -(e.imag - wo.imag);
+    }
+}
+
+// FFT inversa complexa -> real a partir dos n/2 + 1 coeficientes; o resultado
+// não é normalizado (sai multiplicado por n) e in é usado como área de trabalho.
+static void fft_execute_c2r(const FFTPlan *plan, Complex *in, fft_real *out, Complex *work) {
+    int n = plan->n;
+
+    if (n % 2 != 0) {
+        for (int k = 0; k <= n / 2; k++) {
+            work[k] = in[k];
+        }
+        for (int k = n / 2 + 1; k < n; k++) {
+            work[k].real = in[n - k].real;
+            work[k].imag = -in[n - k].imag;
+        }
+        fft_execute_inverse(plan->sub, work, work + n);
+        for (int k = 0; k < n; k++) {
+            out[k] = work[k].real;
+        }
+        return;
+    }
+
+    // reconstrói Z = E + iO a partir de X: E[k] = X[k] + conj(X[m-k]) e
+    // O[k] = (X[k] - conj(X[m-k])) * conj(W^k); o fator 2 resultante completa
+    // a escala n da inversa de tamanho m
+    int m = n / 2;
+    const Complex *w = plan->twiddles;
+    for (int k = 0; k <= m / 2; k++) {
+        Complex xk = in[k];
+        Complex xm = in[m - k];
+        Complex e = {xk.real + xm.real, xk.imag - xm.imag};
+        Complex d = {xk.real - xm.real, xk.imag + xm.imag};
+        Complex o = {d.real * w[k].real + d.imag * w[k].imag, d.imag * w[k].real - d.real * w[k].imag};
+        in[k].real = e.real - o.imag;
+        in[k].imag = e.imag + o.real;
+        if (k > 0 && k != m - k) {
+            // Z[m-k] = conj(E[k]) + i conj(O[k])
+            in[m - k].real = e.real + o.imag;
+            in[m - k].imag = -e.imag + o.real;
+        }
+    }
+
+    fft_execute_inverse(plan->sub, in, work);
+    for (int k = 0; k < m; k++) {
+        out[2 * k] = in[k].real;
+        out[2 * k + 1] = in[k].imag;
+    }
+}
+
+// Pool de threads para paralelizar uma única imagem. Cada chamada de
+// pool_parallel_for_split divide [0, count) em um intervalo contíguo por thread;
+// quem esvazia o próprio intervalo rouba a metade final do intervalo de outra.
+typedef struct {
+    int begin;
+    int end;
+    pthread_mutex_t lock;
+} StealRange;
+
+typedef void (*PoolTask)(void *ctx, int begin, int end, int thread);
+
+typedef struct ThreadPool ThreadPool;
+
+typedef struct {
+    ThreadPool *pool;
+    int id;
+} PoolWorker;
+
+struct ThreadPool {
+    int nthreads;        // inclui a thread que chama pool_parallel_for_split (id 0)
+    pthread_t *threads;
+    PoolWorker *workers;
+    StealRange *ranges;  // um intervalo por thread
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t finished;
+    unsigned generation; // incrementado a cada tarefa publicada
+    int active;          // threads auxiliares ainda trabalhando
+    int shutdown;
+    PoolTask task;
+    void *ctx;
+    int chunk;
+};
+
+// Pega o próximo bloco de índices: primeiro do próprio intervalo, senão
+// roubando de outra thread
+static int pool_take(ThreadPool *pool, int id, int *begin, int *end) {
+    StealRange *own = &pool->ranges[id];
+
+    pthread_mutex_lock(&own->lock);
+    if (own->begin < own->end) {
+        *begin = own->begin;
+        *end = own->begin + pool->chunk < own->end ? own->begin + pool->chunk : own->end;
+        own->begin = *end;
+        pthread_mutex_unlock(&own->lock);
+        return 1;
+    }
+    pthread_mutex_unlock(&own->lock);
+
+    for (int k = 1; k < pool->nthreads; k++) {
+        StealRange *victim = &pool->ranges[(id + k) % pool->nthreads];
+        pthread_mutex_lock(&victim->lock);
+        int left = victim->end - victim->begin;
+        if (left > 0) {
+            int b = victim->end - (left + 1) / 2;
+            int e = victim->end;
+            victim->end = b;
+            pthread_mutex_unlock(&victim->lock);
+
+            *begin = b;
+            *end = b + pool->chunk < e ? b + pool->chunk : e;
+            pthread_mutex_lock(&own->lock);
+            own->begin = *end;
+            own->end = e;
+            pthread_mutex_unlock(&own->lock);
+            return 1;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return 0;
+}
+
+static void pool_work(ThreadPool *pool, int id) {
+    int begin, end;
+    while (pool_take(pool, id, &begin, &end)) {
+        pool->task(pool->ctx, begin, end, id);
+    }
+}
+
+static void *pool_thread(void *arg) {
+    PoolWorker *worker = arg;
+    ThreadPool *pool = worker->pool;
+    unsigned seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->shutdown && pool->generation == seen) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->shutdown) {
+            break;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        pool_work(pool, worker->id);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->active == 0) {
+            pthread_cond_signal(&pool->finished);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static void destroy_thread_pool(ThreadPool *pool);
+
+// Cria um pool com nthreads threads no total (nthreads - 1 auxiliares)
+static ThreadPool *create_thread_pool(int nthreads) {
+    ThreadPool *pool = calloc(1, sizeof(ThreadPool));
+    if (!pool) {
+        return NULL;
+    }
+    pool->threads = malloc(nthreads * sizeof(pthread_t));
+    pool->workers = malloc(nthreads * sizeof(PoolWorker));
+    pool->ranges = calloc(nthreads, sizeof(StealRange));
+    if (!pool->threads || !pool->workers || !pool->ranges) {
+        free(pool->threads);
+        free(pool->workers);
+        free(pool->ranges);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->finished, NULL);
+    for (int i = 0; i < nthreads; i++) {
+        pthread_mutex_init(&pool->ranges[i].lock, NULL);
+    }
+
+    pool->nthreads = 1;
+    for (int i = 1; i < nthreads; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].id = i;
+        if (pthread_create(&pool->threads[i], NULL, pool_thread, &pool->workers[i]) != 0) {
+            perror("Erro ao criar thread");
+            break;
+        }
+        pool->nthreads++;
+    }
+    return pool;
+}
+
+static void destroy_thread_pool(ThreadPool *pool) {
+    if (!pool) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 1; i < pool->nthreads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    for (int i = 0; i < pool->nthreads; i++) {
+        pthread_mutex_destroy(&pool->ranges[i].lock);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->finished);
+    free(pool->threads);
+    free(pool->workers);
+    free(pool->ranges);
+    free(pool);
+}
+
+static int pool_threads(const ThreadPool *pool) {
+    return pool ? pool->nthreads : 1;
+}
+
+#define POOL_SPLIT 16 // blocos de índices por thread em pool_parallel_for_split
+
+// Executa task(ctx, begin, end, thread) sobre todos os índices de [0, count),
+// com a thread chamadora participando; retorna quando todos terminarem. O
+// intervalo de cada thread é pego em cerca de split blocos, um por vez.
+static void pool_parallel_for_split(ThreadPool *pool, int count, int split, PoolTask task, void *ctx) {
+    if (!pool || pool->nthreads == 1 || count <= 1) {
+        task(ctx, 0, count, 0);
+        return;
+    }
+
+    int n = pool->nthreads;
+    for (int i = 0; i < n; i++) {
+        pool->ranges[i].begin = (int)((long long)count * i / n);
+        pool->ranges[i].end = (int)((long long)count * (i + 1) / n);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->ctx = ctx;
+    pool->chunk = count / (n * split) > 0 ? count / (n * split) : 1;
+    pool->active = n - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    pool_work(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->active > 0) {
+        pthread_cond_wait(&pool->finished, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+#define TRANSPOSE_TILE 32 // lado do bloco da transposição (32x32 Complex = 16 KB)
+
+// Transpõe as linhas [row_begin, row_end) de src (rows x cols) para dst
+// (cols x rows), em blocos de tile x tile. Cada bloco de origem e destino cabe
+// na cache, evitando percorrer a imagem inteira com stride.
+static void transpose_block_rows(const Complex *src, Complex *dst, int rows, int cols, int row_begin, int row_end,
+                                 int tile) {
+    for (int r0 = row_begin; r0 < row_end; r0 += tile) {
+        int r1 = r0 + tile < row_end ? r0 + tile : row_end;
+        for (int c0 = 0; c0 < cols; c0 += tile) {
+            int c1 = c0 + tile < cols ? c0 + tile : cols;
+            for (int r = r0; r < r1; r++) {
+                for (int c = c0; c < c1; c++) {
+                    dst[(size_t)c * rows + r] = src[(size_t)r * cols + c];
+                }
+            }
+        }
+    }
+}
+
+// Sentido de uma transformada 2D em lote
+enum {
+    FFT2D_FORWARD, // complexa, in-place em spectrum
+    FFT2D_INVERSE, // complexa inversa não normalizada, in-place em spectrum
+    FFT2D_R2C,     // real -> meio espectro
+    FFT2D_C2R      // meio espectro -> real (não normalizada; spectrum é sobrescrito)
+};
+
+// Parâmetros de fft2d_batch que não mudam o resultado, só o tempo
+typedef struct {
+    int tile;  // lado do bloco das transposições
+    int split; // blocos por thread em cada pool_parallel_for_split
+} Fft2dStrategy;
+
+static const Fft2dStrategy default_fft2d_strategy = {TRANSPOSE_TILE, POOL_SPLIT};
+
+// Sabedoria (--wisdom) para cada tamanho de imagem e número de threads
+typedef struct {
+    int width;
+    int height;
+    int threads;
+    Fft2dStrategy strategy;
+} Fft2dWisdom;
+
+static Fft2dWisdom fft2d_wisdom[MAX_WISDOM];
+static int fft2d_wisdom_count = 0;
+
+static int find_fft2d_wisdom(int width, int height, int threads, Fft2dStrategy *strategy) {
+    int found = 0;
+    pthread_mutex_lock(&wisdom_lock);
+    for (int i = 0; i < fft2d_wisdom_count && !found; i++) {
+        const Fft2dWisdom *entry = &fft2d_wisdom[i];
+        if (entry->width == width && entry->height == height && entry->threads == threads) {
+            *strategy = entry->strategy;
+            found = 1;
+        }
+    }
+    pthread_mutex_unlock(&wisdom_lock);
+    return found;
+}
+
+static void add_fft2d_wisdom(const Fft2dWisdom *choice) {
+    pthread_mutex_lock(&wisdom_lock);
+    int i = 0;
+    for (; i < fft2d_wisdom_count; i++) {
+        const Fft2dWisdom *entry = &fft2d_wisdom[i];
+        if (entry->width == choice->width && entry->height == choice->height && entry->threads == choice->threads) {
+            break;
+        }
+    }
+    if (i < MAX_WISDOM) {
+        fft2d_wisdom[i] = *choice;
+        fft2d_wisdom_count += i == fft2d_wisdom_count;
+        wisdom_dirty = 1;
+    }
+    pthread_mutex_unlock(&wisdom_lock);
+}
+
+// Estado de uma transformada 2D em lote, compartilhado pelas threads
+typedef struct {
+    int direction;
+    int count;
+    int width;
+    int height;
+    int row_len;          // width, ou width/2 + 1 para entrada/saída real
+    const FFTPlan *row_plan;
+    const FFTPlan *col_plan;
+    fft_real **real;
+    Complex **spectrum;
+    Complex *transposed;  // count blocos de row_len x height
+    Complex *work;        // plano de trabalho de cada thread
+    size_t work_len;
+    int tile;             // lado do bloco das transposições
+} Fft2dBatch;
+
+static void fft2d_rows_task(void *ctx, int begin, int end, int thread) {
+    Fft2dBatch *b = ctx;
+    Complex *work = b->work + thread * b->work_len;
+    for (int i = begin; i < end; i++) {
+        int c = i / b->height;
+        size_t y = i % b->height;
+        Complex *row = b->spectrum[c] + y * b->row_len;
+        switch (b->direction) {
+        case FFT2D_FORWARD:
+            fft_execute(b->row_plan, row, work);
+            break;
+        case FFT2D_INVERSE:
+            fft_execute_inverse(b->row_plan, row, work);
+            break;
+        case FFT2D_R2C:
+            fft_execute_r2c(b->row_plan, b->real[c] + y * b->width, row, work);
+            break;
+        case FFT2D_C2R:
+            fft_execute_c2r(b->row_plan, row, b->real[c] + y * b->width, work);
+            break;
+        }
+    }
+}
+
+static void fft2d_columns_task(void *ctx, int begin, int end, int thread) {
+    Fft2dBatch *b = ctx;
+    Complex *work = b->work + thread * b->work_len;
+    for (int i = begin; i < end; i++) {
+        Complex *column = b->transposed + (size_t)i * b->height;
+        if (b->direction == FFT2D_FORWARD || b->direction == FFT2D_R2C) {
+            fft_execute(b->col_plan, column, work);
+        } else {
+            fft_execute_inverse(b->col_plan, column, work);
+        }
+    }
+}
+
+// índices de tarefa das transposições: canal e faixa de b->tile linhas
+static void fft2d_transpose_task(void *ctx, int begin, int end, int thread) {
+    Fft2dBatch *b = ctx;
+    int tiles = (b->height + b->tile - 1) / b->tile;
+    size_t plane = (size_t)b->row_len * b->height;
+    (void)thread;
+    for (int i = begin; i < end; i++) {
+        int c = i / tiles;
+        int r0 = (i % tiles) * b->tile;
+        int r1 = r0 + b->tile < b->height ? r0 + b->tile : b->height;
+        transpose_block_rows(b->spectrum[c], b->transposed + c * plane, b->height, b->row_len, r0, r1, b->tile);
+    }
+}
+
+static void fft2d_transpose_back_task(void *ctx, int begin, int end, int thread) {
+    Fft2dBatch *b = ctx;
+    int tiles = (b->row_len + b->tile - 1) / b->tile;
+    size_t plane = (size_t)b->row_len * b->height;
+    (void)thread;
+    for (int i = begin; i < end; i++) {
+        int c = i / tiles;
+        int r0 = (i % tiles) * b->tile;
+        int r1 = r0 + b->tile < b->row_len ? r0 + b->tile : b->row_len;
+        transpose_block_rows(b->transposed + c * plane, b->spectrum[c], b->row_len, b->height, r0, r1, b->tile);
+    }
+}
+
+static size_t max_size(size_t a, size_t b) {
+    return a > b ? a : b;
+}
+
+// Elementos de scratch exigidos por fft2d_batch: os count planos transpostos
+// mais o trabalho do maior dos dois planos para cada thread
+static size_t fft2d_batch_scratch_len(int direction, int width, int height, int count, int nthreads) {
+    int real = direction == FFT2D_R2C || direction == FFT2D_C2R;
+    FFTPlan *row_plan = real ? get_real_fft_plan(width) : get_fft_plan(width);
+    FFTPlan *col_plan = get_fft_plan(height);
+    if (!row_plan || !col_plan) {
+        return 0;
+    }
+    int row_len = real ? width / 2 + 1 : width;
+    return (size_t)count * row_len * height + nthreads * max_size(row_plan->work_len, col_plan->work_len);
+}
+
+// FFT 2D separável de count planos de uma vez: FFT das linhas, transposição
+// em blocos, FFT das colunas (agora linhas contíguas) e transposição de volta;
+// a inversa percorre os mesmos passos na ordem contrária. Linhas, colunas e
+// blocos de todos os planos são divididos entre as threads do pool (pode ser
+// NULL). Para entrada real só as width/2 + 1 colunas não redundantes são
+// calculadas; as demais valem conj(F[(h-v)%h][w-u]). strategy define os
+// blocos das transposições e a divisão do trabalho entre as threads.
+static int fft2d_batch_as(ThreadPool *pool, const Fft2dStrategy *strategy, int direction, int count, fft_real **real,
+                          Complex **spectrum, Complex *scratch, int width, int height) {
+    Fft2dBatch b;
+    int is_real = direction == FFT2D_R2C || direction == FFT2D_C2R;
+    b.direction = direction;
+    b.count = count;
+    b.width = width;
+    b.height = height;
+    b.row_len = is_real ? width / 2 + 1 : width;
+    b.row_plan = is_real ? get_real_fft_plan(width) : get_fft_plan(width);
+    b.col_plan = get_fft_plan(height);
+    if (!b.row_plan || !b.col_plan) {
+        return -1;
+    }
+    b.real = real;
+    b.spectrum = spectrum;
+    b.transposed = scratch;
+    b.work = scratch + (size_t)count * b.row_len * height;
+    b.work_len = max_size(b.row_plan->work_len, b.col_plan->work_len);
+    b.tile = strategy->tile;
+
+    int split = strategy->split;
+    int row_tiles = count * ((height + b.tile - 1) / b.tile);
+    int col_tiles = count * ((b.row_len + b.tile - 1) / b.tile);
+
+    if (direction != FFT2D_C2R) {
+        pool_parallel_for_split(pool, count * height, split, fft2d_rows_task, &b);
+    }
+    pool_parallel_for_split(pool, row_tiles, split, fft2d_transpose_task, &b);
+    pool_parallel_for_split(pool, count * b.row_len, split, fft2d_columns_task, &b);
+    pool_parallel_for_split(pool, col_tiles, split, fft2d_transpose_back_task, &b);
+    if (direction == FFT2D_C2R) {
+        pool_parallel_for_split(pool, count * height, split, fft2d_rows_task, &b);
+    }
+    return 0;
+}
+
+// fft2d_batch com a estratégia da sabedoria para o tamanho, ou a padrão
+static int fft2d_batch(ThreadPool *pool, int direction, int count, fft_real **real, Complex **spectrum,
+                Complex *scratch, int width, int height) {
+    Fft2dStrategy strategy = default_fft2d_strategy;
+    find_fft2d_wisdom(width, height, pool_threads(pool), &strategy);
+    return fft2d_batch_as(pool, &strategy, direction, count, real, spectrum, scratch, width, height);
+}
+
+static size_t fft2d_r2c_scratch_len(int width, int height) {
+    return fft2d_batch_scratch_len(FFT2D_R2C, width, height, 1, 1);
+}
+
+// FFT 2D de entrada real: out recebe height x (width/2 + 1) coeficientes;
+// scratch precisa de fft2d_r2c_scratch_len(width, height) elementos
+static int fft2d_r2c(const fft_real *in, Complex *out, Complex *scratch, int width, int height) {
+    fft_real *real = (fft_real *)in; // não é modificado na transformada direta
+    return fft2d_batch(NULL, FFT2D_R2C, 1, &real, &out, scratch, width, height);
+}
+
+// Inversa de fft2d_r2c (não normalizada: o resultado sai multiplicado por
+// width * height). O meio espectro em in é sobrescrito.
+static int fft2d_c2r(Complex *in, fft_real *out, Complex *scratch, int width, int height) {
+    return fft2d_batch(NULL, FFT2D_C2R, 1, &out, &in, scratch, width, height);
+}
+
+// Dois canais reais numa única FFT complexa: z = a + i*b. Como a e b são
+// reais, A[k] = (Z[k] + conj(Z[-k])) / 2 e B[k] = (Z[k] - conj(Z[-k])) / 2i.
+// packed precisa de width * height elementos e scratch de
+// fft2d_batch_scratch_len(FFT2D_FORWARD, width, height, 1, pool_threads(pool)).
+static int fft2d_pair(ThreadPool *pool, const fft_real *a, const fft_real *b, Complex *out_a, Complex *out_b,
+               Complex *packed, Complex *scratch, int width, int height) {
+    size_t N = (size_t)width * height;
+    for (size_t i = 0; i < N; i++) {
+        packed[i].real = a[i];
+        packed[i].imag = b[i];
+    }
+
+    if (fft2d_batch(pool, FFT2D_FORWARD, 1, NULL, &packed, scratch, width, height) != 0) {
+        return -1;
+    }
+
+    int half = width / 2 + 1;
+    for (int v = 0; v < height; v++) {
+        const Complex *row = packed + (size_t)v * width;
+        const Complex *mirror = packed + (size_t)((height - v) % height) * width;
+        for (int u = 0; u < half; u++) {
+            Complex z = row[u];
+            Complex zc = mirror[(width - u) % width];
+            Complex *pa = &out_a[(size_t)v * half + u];
+            Complex *pb = &out_b[(size_t)v * half + u];
+            pa->real = 0.5 * (z.real + zc.real);
+            pa->imag = 0.5 * (z.imag - zc.imag);
+            pb->real = 0.5 * (z.imag + zc.imag);
+            pb->imag = -0.5 * (z.real - zc.real);
+        }
+    }
+    return 0;
+}
+
+// Reconstrói uma linha do espectro completo a partir da linha v do meio
+// espectro e da linha espelhada (height - v) % height
+static void expand_spectrum_row(const Complex *src, const Complex *mirror, Complex *dst, int width) {
+    int half = width / 2 + 1;
+    for (int u = 0; u < width; u++) {
+        if (u < half) {
+            dst[u] = src[u];
+        } else {
+            dst[u].real = mirror[width - u].real;
+            dst[u].imag = -mirror[width - u].imag;
+        }
+    }
+}
+
+// Reconstrói o espectro completo (height x width) a partir do meio espectro
+static void expand_half_spectrum(const Complex *half_spectrum, Complex *full, int width, int height) {
+    int half = width / 2 + 1;
+    for (int v = 0; v < height; v++) {
+        const Complex *src = half_spectrum + (size_t)v * half;
+        const Complex *mirror = half_spectrum + (size_t)((height - v) % height) * half;
+        expand_spectrum_row(src, mirror, full + (size_t)v * width, width);
+    }
+}
+
+// Buffers grandes (workspaces, .txt e passadas do modo fora da memória):
+// mapeados direto no POSIX, para voltarem ao sistema ao serem liberados. Com
+// malloc, blocos grandes liberados podem ficar no heap de cada thread e a
+// memória residente de uma imagem somaria à da seguinte.
+static void *pages_alloc(size_t bytes) {
+#ifndef _WIN32
+    void *p = mmap(NULL, bytes ? bytes : 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+#else
+    return malloc(bytes);
+#endif
+}
+
+static void pages_free(void *p, size_t bytes) {
+#ifndef _WIN32
+    if (p) {
+        munmap(p, bytes ? bytes : 1);
+    }
+#else
+    (void)bytes;
+    free(p);
+#endif
+}
+
+// Buffers de trabalho de uma thread, reaproveitados de uma imagem para a
+// próxima: só são realocados quando uma imagem maior aparece
+enum {
+    WS_INPUT,    // planos de amostras reais da FFT, um por canal
+    WS_SPECTRUM, // meio espectro
+    WS_SCRATCH,  // scratch de fft2d / fft2d_r2c
+    WS_PACKED,   // dois canais empacotados (--pack-channels)
+    WS_FULL,     // espectro completo (--full-spectrum)
+    WS_MASK,     // máscara dos filtros (--filter)
+    WS_TILE,     // blocos da convolução / correlação, um plano por canal
+    WS_TILE_SPECTRUM, // meios espectros dos blocos
+    WS_OUTPUT,   // imagem convolvida ou somas acumuladas da correlação
+    WS_PIXELS,   // imagem do espectro (--spectrum-bmp)
+    WS_MAGNITUDE, // log(1 + |F|) dos meios espectros (--spectrum-bmp)
+    WS_SLOTS
+};
+
+typedef struct {
+    void *buffers[WS_SLOTS];
+    size_t sizes[WS_SLOTS];
+    ThreadPool *pool; // threads que dividem a FFT de cada imagem (-t)
+    int threads;      // tamanho do pool (0 = options.threads)
+    unsigned allocations; // buffers alocados até agora
+    int mask_width;       // tamanho para o qual WS_MASK foi calculada
+    int mask_height;
+} Workspace;
+
+// Retorna o buffer do slot com pelo menos bytes bytes (conteúdo não preservado)
+static void *workspace_get(Workspace *ws, int slot, size_t bytes) {
+    if (ws->sizes[slot] < bytes) {
+        pages_free(ws->buffers[slot], ws->sizes[slot]);
+        ws->allocations++;
+        ws->buffers[slot] = pages_alloc(bytes);
+        ws->sizes[slot] = ws->buffers[slot] ? bytes : 0;
+        if (slot == WS_MASK) {
+            ws->mask_width = ws->mask_height = 0;
+        }
+    }
+    return ws->buffers[slot];
+}
+
+// Pool da thread, criado na primeira imagem quando há mais de uma thread
+static ThreadPool *workspace_pool(Workspace *ws) {
+    int threads = ws->threads ? ws->threads : options.threads;
+    if (!ws->pool && threads > 1) {
+        ws->pool = create_thread_pool(threads);
+    }
+    return ws->pool;
+}
+
+// Libera os buffers e mantém o pool
+static void workspace_trim(Workspace *ws) {
+    for (int i = 0; i < WS_SLOTS; i++) {
+        pages_free(ws->buffers[i], ws->sizes[i]);
+        ws->buffers[i] = NULL;
+        ws->sizes[i] = 0;
+    }
+    ws->mask_width = ws->mask_height = 0;
+}
+
+static void workspace_free(Workspace *ws) {
+    workspace_trim(ws);
+    destroy_thread_pool(ws->pool);
+    ws->pool = NULL;
+}
+
+// Medições por imagem (--stats, --metrics): tempo em cada etapa, bytes lidos
+// e gravados e buffers alocados. Sem options.stats, metrics_clock devolve
+// sempre zero e nada é medido.
+enum {
+    STAGE_READ,    // abrir e validar o BMP
+    STAGE_SPLIT,   // separar os canais, trazendo as páginas do arquivo
+    STAGE_FFT,     // no modo fora da memória, também a leitura e a troca de faixas com o disco
+    STAGE_PREVIEW, // prévias dos canais ou imagem filtrada
+    STAGE_DAT,
+    STAGE_TXT,
+    STAGE_COUNT
+};
+
+static const char *const stage_names[STAGE_COUNT] = {"read", "split", "fft", "preview", "dat", "txt"};
+
+typedef struct {
+    double seconds[STAGE_COUNT];
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    unsigned allocations;
+} ImageMetrics;
+
+// Totais do lote, acumulados pelas threads de escrita
+static struct {
+    pthread_mutex_t lock;
+    FILE *sink;
+    ImageMetrics total;
+    int images;
+    double start;
+} run_metrics = {PTHREAD_MUTEX_INITIALIZER, NULL, {{0}, 0, 0, 0}, 0, 0};
+
+// Relógio monotônico em segundos
+static double now_seconds(void) {
+    struct timespec ts;
+#ifndef _WIN32
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double metrics_clock(void) {
+    return options.stats ? now_seconds() : 0.0;
+}
+
+// Soma o tempo desde start à etapa; metrics pode ser NULL
+static void metrics_add(ImageMetrics *metrics, int stage, double start) {
+    if (metrics && options.stats) {
+        metrics->seconds[stage] += now_seconds() - start;
+    }
+}
+
+static void json_write_string(FILE *fp, const char *text) {
+    fputc('"', fp);
+    for (const unsigned char *p = (const unsigned char *)text; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            fprintf(fp, "\\%c", *p);
+        } else if (*p < 0x20) {
+            fprintf(fp, "\\u%04x", *p);
+        } else {
+            fputc(*p, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+static void json_write_metrics(FILE *fp, const ImageMetrics *metrics) {
+    fprintf(fp, "\"seconds\": {");
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        fprintf(fp, "%s\"%s\": %.6f", stage ? ", " : "", stage_names[stage], metrics->seconds[stage]);
+    }
+    fprintf(fp, "}, \"bytes_read\": %llu, \"bytes_written\": %llu, \"allocations\": %u",
+            (unsigned long long)metrics->bytes_read, (unsigned long long)metrics->bytes_written,
+            metrics->allocations);
+}
+
+// Começa as medições do lote; options.metrics_path recebe as linhas JSON
+static PROGRAM_ONLY int metrics_open(void) {
+    if (options.metrics_path) {
+        run_metrics.sink = fopen(options.metrics_path, "w");
+        if (!run_metrics.sink) {
+            perror("Erro ao criar arquivo de metricas");
+            return -1;
+        }
+    }
+    run_metrics.start = now_seconds();
+    return 0;
+}
+
+// Acumula as medições de uma imagem concluída
+static void metrics_record(const char *source, int image_index, int width, int height, const ImageMetrics *metrics) {
+    if (!options.stats) {
+        return;
+    }
+    pthread_mutex_lock(&run_metrics.lock);
+    ImageMetrics *total = &run_metrics.total;
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        total->seconds[stage] += metrics->seconds[stage];
+    }
+    total->bytes_read += metrics->bytes_read;
+    total->bytes_written += metrics->bytes_written;
+    total->allocations += metrics->allocations;
+    run_metrics.images++;
+    if (run_metrics.sink) {
+        fprintf(run_metrics.sink, "{\"type\": \"image\", \"index\": %d, \"file\": ", image_index);
+        json_write_string(run_metrics.sink, source);
+        fprintf(run_metrics.sink, ", \"width\": %d, \"height\": %d, ", width, height);
+        json_write_metrics(run_metrics.sink, metrics);
+        fprintf(run_metrics.sink, "}\n");
+    }
+    pthread_mutex_unlock(&run_metrics.lock);
+}
+
+// Pico de memória residente do processo, em bytes (0 se não disponível)
+static uint64_t peak_rss_bytes(void) {
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+        return (uint64_t)usage.ru_maxrss; // já em bytes
+#else
+        return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+    }
+#endif
+    return 0;
+}
+
+// Resume o lote na tela e na última linha JSON
+static PROGRAM_ONLY void metrics_finish(void) {
+    if (!options.stats) {
+        return;
+    }
+    const ImageMetrics *total = &run_metrics.total;
+    double wall = now_seconds() - run_metrics.start;
+    uint64_t peak_rss = peak_rss_bytes();
+
+    printf("Imagens: %d em %.3f s\n", run_metrics.images, wall);
+    printf("Tempo por etapa (s, somado entre threads):");
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        printf(" %s %.3f", stage_names[stage], total->seconds[stage]);
+    }
+    printf("\nLidos: %.1f MB, gravados: %.1f MB, alocacoes: %u, pico de memoria: %.1f MB\n",
+           total->bytes_read / 1048576.0, total->bytes_written / 1048576.0, total->allocations,
+           peak_rss / 1048576.0);
+
+    if (run_metrics.sink) {
+        fprintf(run_metrics.sink, "{\"type\": \"run\", \"images\": %d, \"wall_seconds\": %.6f, ", run_metrics.images, wall);
+        json_write_metrics(run_metrics.sink, total);
+        fprintf(run_metrics.sink, ", \"peak_rss_bytes\": %llu}\n", (unsigned long long)peak_rss);
+        fclose(run_metrics.sink);
+        run_metrics.sink = NULL;
+    }
+}
+
+// Autoajuste (--wisdom). Na primeira imagem de cada tamanho, os tamanhos
+// potência de 2 das FFTs 1D que ela usa (linhas, colunas ou a FFT interna de
+// Bluestein) são medidos com o radix-4 em cada kernel e com o Stockham, e a
+// FFT 2D com blocos de transposição de 16, 32 e 64 e com 4, 16 e 64 blocos
+// por thread. As escolhas valem para os planos criados depois, são gravadas
+// no fim e, lidas do arquivo nas execuções seguintes, dispensam as medições.
+// Um plano já criado antes do ajuste fica como está até a próxima execução.
+#define WISDOM_VERSION 1
+#define TUNE_ELEMENTS (1 << 18) // pontos transformados em cada medição 1D
+#define TUNE_RUNS 3             // medições de cada candidato; vale a menor
+
+static pthread_mutex_t tune_lock = PTHREAD_MUTEX_INITIALIZER; // um tamanho ajustado por vez
+
+// Tamanho potência de 2 cujo algoritmo decide o tempo de uma FFT complexa de
+// n pontos: o próprio n ou a FFT interna de Bluestein (0 para radix misto)
+static int tunable_size(int n) {
+    int factors[MAX_FFT_FACTORS];
+    int nfactors;
+    if (is_power_of_two(n)) {
+        return n;
+    }
+    if (factorize_small_primes(n, factors, &nfactors)) {
+        return 0;
+    }
+    int m = 1;
+    while (m < 2 * n - 1) {
+        m <<= 1;
+    }
+    return m;
+}
+
+// Menor tempo de plan sobre as rows linhas de source, copiadas para data
+static double time_plan(const FFTPlan *plan, const Complex *source, Complex *data, Complex *work, int rows) {
+    size_t n = plan->n;
+    double best = HUGE_VAL;
+    for (int run = 0; run < TUNE_RUNS; run++) {
+        memcpy(data, source, rows * n * sizeof(Complex));
+        double start = now_seconds();
+        for (int r = 0; r < rows; r++) {
+            fft_execute(plan, data + r * n, work);
+        }
+        double elapsed = now_seconds() - start;
+        best = elapsed < best ? elapsed : best;
+    }
+    return best;
+}
+
+static void tune_plan(int n) {
+    PlanWisdom choice;
+    if (n < 16 || find_plan_wisdom(n, &choice)) {
+        return;
+    }
+    int rows = TUNE_ELEMENTS / n > 0 ? TUNE_ELEMENTS / n : 1;
+    size_t len = (size_t)rows * n;
+    Complex *source = malloc(len * sizeof(Complex));
+    Complex *data = malloc(len * sizeof(Complex));
+    if (!source || !data) {
+        perror("Erro ao alocar memoria para o autoajuste");
+        goto done;
+    }
+    for (size_t i = 0; i < len; i++) {
+        source[i].real = (uint32_t)(i * 2654435761u) >> 24;
+        source[i].imag = (uint32_t)(i * 40503u) >> 8 & 0xFF;
+    }
+
+    // candidatos: radix-4 em cada kernel permitido, depois Stockham
+    int kernels = (int)(select_radix4_kernel() - radix4_kernels) + 1;
+    double best = HUGE_VAL;
+    for (int k = 0; k <= kernels; k++) {
+        PlanWisdom candidate = {n, k < kernels ? FFT_RADIX4 : FFT_MIXED_RADIX, k < kernels ? &radix4_kernels[k] : NULL};
+        FFTPlan *plan = create_fft_plan_as(&candidate);
+        Complex *work = plan ? malloc(plan->work_len * sizeof(Complex)) : NULL;
+        if (work) {
+            double elapsed = time_plan(plan, source, data, work, rows);
+            if (elapsed < best) {
+                best = elapsed;
+                choice = candidate;
+            }
+        }
+        free(work);
+        destroy_fft_plan(plan);
+    }
+    if (best < HUGE_VAL) {
+        add_plan_wisdom(&choice);
+        printf("Autoajuste da FFT de %d pontos: %s\n", n,
+               choice.kind == FFT_MIXED_RADIX ? "stockham" : choice.kernel->name);
+    }
+
+done:
+    free(source);
+    free(data);
+}
+
+// Menor tempo da FFT 2D dos três canais com strategy
+static double time_fft2d(ThreadPool *pool, const Fft2dStrategy *strategy, fft_real **planes, Complex **spectra,
+                         Complex *scratch, int width, int height) {
+    double best = HUGE_VAL;
+    for (int run = 0; run < TUNE_RUNS; run++) {
+        double start = now_seconds();
+        if (fft2d_batch_as(pool, strategy, FFT2D_R2C, 3, planes, spectra, scratch, width, height) != 0) {
+            return HUGE_VAL;
+        }
+        double elapsed = now_seconds() - start;
+        best = elapsed < best ? elapsed : best;
+    }
+    return best;
+}
+
+// Ajusta as FFTs de imagens width x height se a sabedoria ainda não as
+// conhece. planes (com a imagem) e spectra servem de dados para as medições.
+static void wisdom_tune(Workspace *ws, fft_real **planes, Complex **spectra, int width, int height) {
+    static const int tiles[] = {16, 32, 64};
+    static const int splits[] = {4, 16, 64};
+    if (!options.wisdom_path) {
+        return;
+    }
+    ThreadPool *pool = workspace_pool(ws);
+    int threads = pool_threads(pool);
+    Fft2dWisdom choice = {width, height, threads, default_fft2d_strategy};
+    if (find_fft2d_wisdom(width, height, threads, &choice.strategy)) {
+        return;
+    }
+    pthread_mutex_lock(&tune_lock);
+    if (find_fft2d_wisdom(width, height, threads, &choice.strategy)) {
+        goto done;
+    }
+
+    // os planos 1D primeiro, antes que fft2d_batch os crie
+    if (options.pack_channels) {
+        tune_plan(tunable_size(width));
+    }
+    tune_plan(tunable_size(width % 2 == 0 ? width / 2 : width));
+    tune_plan(tunable_size(height));
+
+    size_t scratch_len = fft2d_batch_scratch_len(FFT2D_R2C, width, height, 3, threads);
+    Complex *scratch = scratch_len ? workspace_get(ws, WS_SCRATCH, scratch_len * sizeof(Complex)) : NULL;
+    if (!scratch) {
+        goto done;
+    }
+    double best = HUGE_VAL;
+    for (size_t i = 0; i < sizeof(tiles) / sizeof(tiles[0]); i++) {
+        Fft2dStrategy candidate = {tiles[i], POOL_SPLIT};
+        double elapsed = time_fft2d(pool, &candidate, planes, spectra, scratch, width, height);
+        if (elapsed < best) {
+            best = elapsed;
+            choice.strategy = candidate;
+        }
+    }
+    // a divisão só importa com mais de uma thread; POOL_SPLIT já foi medida
+    for (size_t i = 0; i < sizeof(splits) / sizeof(splits[0]) && threads > 1; i++) {
+        Fft2dStrategy candidate = {choice.strategy.tile, splits[i]};
+        if (splits[i] == POOL_SPLIT) {
+            continue;
+        }
+        double elapsed = time_fft2d(pool, &candidate, planes, spectra, scratch, width, height);
+        if (elapsed < best) {
+            best = elapsed;
+            choice.strategy = candidate;
+        }
+    }
+    if (best < HUGE_VAL) {
+        add_fft2d_wisdom(&choice);
+        printf("Autoajuste da FFT 2D %dx%d com %d threads: blocos de %d, divisao em %d\n", width, height, threads,
+               choice.strategy.tile, choice.strategy.split);
+    }
+
+done:
+    pthread_mutex_unlock(&tune_lock);
+}
+
+// Arquivo de sabedoria, em texto: a linha "imgfourier-wisdom VERSAO PRECISAO"
+// seguida de "plan N radix4 KERNEL", "plan N stockham" e "fft2d LARGURA
+// ALTURA THREADS BLOCO DIVISAO". Um arquivo de outra versão ou precisão é
+// ignorado e refeito; entradas com kernel que esta CPU ou --simd não permitem
+// são medidas de novo.
+static PROGRAM_ONLY int wisdom_load(const char *filename) {
+    FILE *fp = fopen(filename, "r");
+    if (!fp) {
+        if (errno == ENOENT) {
+            return 0; // primeira execução: o arquivo é criado no fim
+        }
+        perror("Erro ao abrir o arquivo de sabedoria");
+        return -1;
+    }
+    char line[256];
+    char precision[16];
+    int version;
+    if (!fgets(line, sizeof(line), fp) || sscanf(line, "imgfourier-wisdom %d %15s", &version, precision) != 2 ||
+        version != WISDOM_VERSION || strcmp(precision, FFT_PRECISION_NAME) != 0) {
+        fprintf(stderr, "Sabedoria de outra versao ou precisao, sera refeita: %s\n", filename);
+        fclose(fp);
+        return 0;
+    }
+
+    const Radix4Kernel *widest = select_radix4_kernel();
+    while (fgets(line, sizeof(line), fp)) {
+        char algorithm[16];
+        char kernel[16];
+        PlanWisdom plan = {0, FFT_RADIX4, NULL};
+        Fft2dWisdom size;
+        int fields = sscanf(line, "plan %d %15s %15s", &plan.n, algorithm, kernel);
+        if (fields >= 2 && is_power_of_two(plan.n)) {
+            if (strcmp(algorithm, "stockham") == 0) {
+                plan.kind = FFT_MIXED_RADIX;
+            } else if (fields == 3 && strcmp(algorithm, "radix4") == 0) {
+                for (const Radix4Kernel *k = radix4_kernels; k <= widest; k++) {
+                    if (strcmp(k->name, kernel) == 0) {
+                        plan.kernel = k;
+                    }
+                }
+            }
+            if (plan.kind == FFT_MIXED_RADIX || plan.kernel) {
+                add_plan_wisdom(&plan);
+            }
+        } else if (sscanf(line, "fft2d %d %d %d %d %d", &size.width, &size.height, &size.threads,
+                          &size.strategy.tile, &size.strategy.split) == 5 &&
+                   size.strategy.tile > 0 && size.strategy.split > 0) {
+            add_fft2d_wisdom(&size);
+        }
+    }
+    fclose(fp);
+    wisdom_dirty = 0;
+    printf("Sabedoria: %d planos e %d tamanhos de imagem em %s\n", plan_wisdom_count, fft2d_wisdom_count, filename);
+    return 0;
+}
+
+// Arquivos de estado (sabedoria, manifesto) são escritos em NOME.tmp e só
+// renomeados sobre o original depois de completos, para que uma execução
+// interrompida não os deixe pela metade
+static FILE *replace_open(const char *filename, char **temporary) {
+    *temporary = malloc(strlen(filename) + 5);
+    if (!*temporary) {
+        return NULL;
+    }
+    sprintf(*temporary, "%s.tmp", filename);
+    FILE *fp = fopen(*temporary, "w");
+    if (!fp) {
+        free(*temporary);
+        *temporary = NULL;
+    }
+    return fp;
+}
+
+static int replace_commit(FILE *fp, const char *filename, char *temporary) {
+    int status = ferror(fp) ? -1 : 0;
+    status |= fclose(fp) != 0 ? -1 : 0;
+#ifdef _WIN32
+    remove(filename); // rename não substitui um arquivo existente
+#endif
+    if (status != 0 || rename(temporary, filename) != 0) {
+        remove(temporary);
+        status = -1;
+    }
+    free(temporary);
+    return status;
+}
+
+// Grava a sabedoria se o ajuste acrescentou algo
+static PROGRAM_ONLY int wisdom_save(const char *filename) {
+    if (!wisdom_dirty) {
+        return 0;
+    }
+    char *temporary;
+    FILE *fp = replace_open(filename, &temporary);
+    if (!fp) {
+        perror("Erro ao gravar o arquivo de sabedoria");
+        return -1;
+    }
+
+    fprintf(fp, "imgfourier-wisdom %d %s\n", WISDOM_VERSION, FFT_PRECISION_NAME);
+    pthread_mutex_lock(&wisdom_lock);
+    for (int i = 0; i < plan_wisdom_count; i++) {
+        if (plan_wisdom[i].kind == FFT_MIXED_RADIX) {
+            fprintf(fp, "plan %d stockham\n", plan_wisdom[i].n);
+        } else {
+            fprintf(fp, "plan %d radix4 %s\n", plan_wisdom[i].n, plan_wisdom[i].kernel->name);
+        }
+    }
+    for (int i = 0; i < fft2d_wisdom_count; i++) {
+        const Fft2dWisdom *entry = &fft2d_wisdom[i];
+        fprintf(fp, "fft2d %d %d %d %d %d\n", entry->width, entry->height, entry->threads, entry->strategy.tile,
+                entry->strategy.split);
+    }
+    wisdom_dirty = 0;
+    pthread_mutex_unlock(&wisdom_lock);
+
+    if (replace_commit(fp, filename, temporary) != 0) {
+        perror("Erro ao gravar o arquivo de sabedoria");
+        return -1;
+    }
+    return 0;
+}
+
+// Arquivo acessado por posição: pread/pwrite, ou fseek + fread/fwrite em
+// _WIN32, onde cada arquivo só pode ser usado por uma thread de cada vez
+typedef struct {
+#ifndef _WIN32
+    int fd;
+#else
+    FILE *fp;
+    char filename[MAX_FILENAME_LENGTH]; // apagado ao fechar, se temporary
+    int temporary;
+#endif
+} DiskFile;
+
+// Abre para leitura e escrita, criando o arquivo se ele não existe
+static int disk_open(DiskFile *file, const char *filename) {
+#ifndef _WIN32
+    file->fd = open(filename, O_RDWR | O_CREAT, 0644);
+    return file->fd < 0 ? -1 : 0;
+#else
+    file->temporary = 0;
+    file->fp = fopen(filename, "r+b");
+    if (!file->fp) {
+        file->fp = fopen(filename, "w+b");
+    }
+    return file->fp ? 0 : -1;
+#endif
+}
+
+// Cria um arquivo temporário com o prefixo dado, que some ao ser fechado
+static int disk_open_temporary(DiskFile *file, const char *prefix) {
+#ifndef _WIN32
+    char filename[MAX_FILENAME_LENGTH];
+    if (snprintf(filename, sizeof(filename), "%s_XXXXXX", prefix) >= (int)sizeof(filename)) {
+        errno = ENAMETOOLONG; // sem o sufixo, mkstemp falharia ou usaria outro caminho
+        return -1;
+    }
+    file->fd = mkstemp(filename);
+    if (file->fd < 0) {
+        return -1;
+    }
+    unlink(filename); // o espaço é liberado ao fechar, mesmo se o programa for interrompido
+    return 0;
+#else
+    if (snprintf(file->filename, sizeof(file->filename), "%s.tmp", prefix) >= (int)sizeof(file->filename)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    file->temporary = 1;
+    file->fp = fopen(file->filename, "w+b");
+    return file->fp ? 0 : -1;
+#endif
+}
+
+static void disk_close(DiskFile *file) {
+#ifndef _WIN32
+    close(file->fd);
+#else
+    fclose(file->fp);
+    if (file->temporary) {
+        remove(file->filename);
+    }
+#endif
+}
+
+// Lê ou grava bytes bytes na posição offset
+static int disk_io(DiskFile *file, void *buffer, size_t bytes, uint64_t offset, int writing) {
+#ifndef _WIN32
+    uint8_t *p = buffer;
+    while (bytes > 0) {
+        ssize_t done = writing ? pwrite(file->fd, p, bytes, (off_t)offset) : pread(file->fd, p, bytes, (off_t)offset);
+        if (done <= 0) {
+            return -1;
+        }
+        p += done;
+        bytes -= done;
+        offset += done;
+    }
+    return 0;
+#else
+    if (_fseeki64(file->fp, (long long)offset, SEEK_SET) != 0) {
+        return -1;
+    }
+    size_t done = writing ? fwrite(buffer, 1, bytes, file->fp) : fread(buffer, 1, bytes, file->fp);
+    return done == bytes ? 0 : -1;
+#endif
+}
+
+// Garante que o que foi gravado até aqui chegou ao disco
+static int disk_sync(DiskFile *file) {
+#ifndef _WIN32
+    return fdatasync(file->fd);
+#else
+    return fflush(file->fp) == 0 && _commit(_fileno(file->fp)) == 0 ? 0 : -1;
+#endif
+}
+
+static uint64_t disk_size(DiskFile *file) {
+#ifndef _WIN32
+    struct stat st;
+    return fstat(file->fd, &st) == 0 ? (uint64_t)st.st_size : 0;
+#else
+    _fseeki64(file->fp, 0, SEEK_END);
+    return (uint64_t)_ftelli64(file->fp);
+#endif
+}
+
+// Formatação dos números do .txt sem printf. Por padrão cada double sai na
+// menor representação decimal que, lida de volta com strtod, reproduz
+// exatamente o mesmo valor (Grisu3: o valor e as fronteiras do seu intervalo
+// de arredondamento são escalados por uma potência de 10 em cache e os
+// dígitos são gerados em aritmética inteira de 64 bits; nos raros casos em
+// que o erro dessa aritmética deixa o resultado incerto, uma busca exata com
+// snprintf e strtod decide). Com options.txt_precision, sai com casas
+// decimais fixas, como "%.*f".
+
+#define TXT_BUFFER_SIZE (1 << 20) // bytes acumulados antes de cada fwrite
+#define TXT_NUMBER_MAX 48         // maior número formatado, com folga: sinal, 17 + 17 dígitos e ponto
+
+// Ponto flutuante "faça você mesmo": f * 2^e com significando de 64 bits
+typedef struct {
+    uint64_t f;
+    int e;
+} DiyFp;
+
+// 10^k para k = -348, -340, ..., 340, normalizadas (bit 63 ligado)
+static const uint64_t cached_powers_f[] = {
+    0xfa8fd5a0081c0288, 0xbaaee17fa23ebf76, 0x8b16fb203055ac76, 0xcf42894a5dce35ea,
+    0x9a6bb0aa55653b2d, 0xe61acf033d1a45df, 0xab70fe17c79ac6ca, 0xff77b1fcbebcdc4f,
+    0xbe5691ef416bd60c, 0x8dd01fad907ffc3c, 0xd3515c2831559a83, 0x9d71ac8fada6c9b5,
+    0xea9c227723ee8bcb, 0xaecc49914078536d, 0x823c12795db6ce57, 0xc21094364dfb5637,
+    0x9096ea6f3848984f, 0xd77485cb25823ac7, 0xa086cfcd97bf97f4, 0xef340a98172aace5,
+    0xb23867fb2a35b28e, 0x84c8d4dfd2c63f3b, 0xc5dd44271ad3cdba, 0x936b9fcebb25c996,
+    0xdbac6c247d62a584, 0xa3ab66580d5fdaf6, 0xf3e2f893dec3f126, 0xb5b5ada8aaff80b8,
+    0x87625f056c7c4a8b, 0xc9bcff6034c13053, 0x964e858c91ba2655, 0xdff9772470297ebd,
+    0xa6dfbd9fb8e5b88f, 0xf8a95fcf88747d94, 0xb94470938fa89bcf, 0x8a08f0f8bf0f156b,
+    0xcdb02555653131b6, 0x993fe2c6d07b7fac, 0xe45c10c42a2b3b06, 0xaa242499697392d3,
+    0xfd87b5f28300ca0e, 0xbce5086492111aeb, 0x8cbccc096f5088cc, 0xd1b71758e219652c,
+    0x9c40000000000000, 0xe8d4a51000000000, 0xad78ebc5ac620000, 0x813f3978f8940984,
+    0xc097ce7bc90715b3, 0x8f7e32ce7bea5c70, 0xd5d238a4abe98068, 0x9f4f2726179a2245,
+    0xed63a231d4c4fb27, 0xb0de65388cc8ada8, 0x83c7088e1aab65db, 0xc45d1df942711d9a,
+    0x924d692ca61be758, 0xda01ee641a708dea, 0xa26da3999aef774a, 0xf209787bb47d6b85,
+    0xb454e4a179dd1877, 0x865b86925b9bc5c2, 0xc83553c5c8965d3d, 0x952ab45cfa97a0b3,
+    0xde469fbd99a05fe3, 0xa59bc234db398c25, 0xf6c69a72a3989f5c, 0xb7dcbf5354e9bece,
+    0x88fcf317f22241e2, 0xcc20ce9bd35c78a5, 0x98165af37b2153df, 0xe2a0b5dc971f303a,
+    0xa8d9d1535ce3b396, 0xfb9b7cd9a4a7443c, 0xbb764c4ca7a44410, 0x8bab8eefb6409c1a,
+    0xd01fef10a657842c, 0x9b10a4e5e9913129, 0xe7109bfba19c0c9d, 0xac2820d9623bf429,
+    0x80444b5e7aa7cf85, 0xbf21e44003acdd2d, 0x8e679c2f5e44ff8f, 0xd433179d9c8cb841,
+    0x9e19db92b4e31ba9, 0xeb96bf6ebadf77d9, 0xaf87023b9bf0ee6b
+};
+static const int16_t cached_powers_e[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954, -927,
+    -901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635, -608,
+    -582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316, -289,
+    -263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30,
+    56, 83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614, 641, 667,
+    694, 720, 747, 774, 800, 827, 853, 880, 907, 933, 960, 986,
+    1013, 1039, 1066
+};
+
+static const uint64_t pow10_u64[] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL,
+    1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+    1000000000000000000ULL, 10000000000000000000ULL
+};
+
+static DiyFp diyfp_normalize(DiyFp v) {
+#ifdef __GNUC__
+    int shift = __builtin_clzll(v.f);
+#else
+    int shift = 0;
+    while (!(v.f & (1ULL << (63 - shift)))) {
+        shift++;
+    }
+#endif
+    v.f <<= shift;
+    v.e -= shift;
+    return v;
+}
+
+// Produto arredondado nos 64 bits mais altos
+static DiyFp diyfp_multiply(DiyFp x, DiyFp y) {
+    const uint64_t mask = 0xFFFFFFFFu;
+    uint64_t a = x.f >> 32, b = x.f & mask;
+    uint64_t c = y.f >> 32, d = y.f & mask;
+    uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    uint64_t middle = (bd >> 32) + (ad & mask) + (bc & mask) + (1u << 31);
+    DiyFp r = {ac + (ad >> 32) + (bc >> 32) + (middle >> 32), x.e + y.e + 64};
+    return r;
+}
+
+// Potência de 10 em cache que leva o expoente binário e para perto de -60;
+// *K recebe o expoente decimal pelo qual o resultado terá de ser corrigido
+static DiyFp cached_power(int e, int *K) {
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int k = (int)dk;
+    if (dk - k > 0.0) {
+        k++;
+    }
+    int index = (k >> 3) + 1;
+    *K = -(-348 + index * 8);
+    DiyFp r = {cached_powers_f[index], cached_powers_e[index]};
+    return r;
+}
+
+// Ajusta o último dígito para o valor mais próximo de w dentro do intervalo
+// inseguro (as fronteiras alargadas em unit, o erro das multiplicações).
+// Retorna 0 só se os dígitos são com certeza os mais curtos que voltam a
+// value e os mais próximos dele; senão o resultado é incerto.
+static int grisu_round_weed(char *digits, int length, uint64_t distance_too_high_w, uint64_t unsafe_interval,
+                            uint64_t rest, uint64_t ten_kappa, uint64_t unit) {
+    uint64_t small_distance = distance_too_high_w - unit;
+    uint64_t big_distance = distance_too_high_w + unit;
+    while (rest < small_distance && unsafe_interval - rest >= ten_kappa &&
+           (rest + ten_kappa < small_distance || small_distance - rest >= rest + ten_kappa - small_distance)) {
+        digits[length - 1]--;
+        rest += ten_kappa;
+    }
+    // com o erro de w, outro dígito poderia estar mais perto
+    if (rest < big_distance && unsafe_interval - rest >= ten_kappa &&
+        (rest + ten_kappa < big_distance || big_distance - rest > rest + ten_kappa - big_distance)) {
+        return -1;
+    }
+    // o resultado precisa estar com certeza dentro do intervalo seguro
+    return 2 * unit <= rest && rest <= unsafe_interval - 4 * unit ? 0 : -1;
+}
+
+// Gera os dígitos de too_high enquanto o resto não cai no intervalo inseguro
+// (too_low, too_high); *K é corrigido pela posição do último dígito
+static int grisu_digits(DiyFp too_low, DiyFp w, DiyFp too_high, char *digits, int *length, int *K) {
+    DiyFp one = {1ULL << -w.e, w.e};
+    uint64_t unit = 1;
+    uint64_t unsafe_interval = too_high.f - too_low.f;
+    uint64_t distance_too_high_w = too_high.f - w.f;
+    uint32_t p1 = (uint32_t)(too_high.f >> -one.e);
+    uint64_t p2 = too_high.f & (one.f - 1);
+    int kappa = 1;
+    while (kappa < 10 && p1 >= pow10_u64[kappa]) {
+        kappa++;
+    }
+    *length = 0;
+
+    // parte inteira
+    while (kappa > 0) {
+        uint32_t d = p1 / (uint32_t)pow10_u64[kappa - 1];
+        p1 %= (uint32_t)pow10_u64[kappa - 1];
+        if (d || *length) {
+            digits[(*length)++] = (char)('0' + d);
+        }
+        kappa--;
+        uint64_t rest = ((uint64_t)p1 << -one.e) + p2;
+        if (rest < unsafe_interval) {
+            *K += kappa;
+            return grisu_round_weed(digits, *length, distance_too_high_w, unsafe_interval, rest,
+                                    pow10_u64[kappa] << -one.e, unit);
+        }
+    }
+
+    // parte fracionária
+    for (;;) {
+        p2 *= 10;
+        unit *= 10;
+        unsafe_interval *= 10;
+        char d = (char)(p2 >> -one.e);
+        if (d || *length) {
+            digits[(*length)++] = (char)('0' + d);
+        }
+        p2 &= one.f - 1;
+        kappa--;
+        if (p2 < unsafe_interval) {
+            *K += kappa;
+            return grisu_round_weed(digits, *length, distance_too_high_w * unit, unsafe_interval, p2, one.f,
+                                    unit);
+        }
+    }
+}
+
+// Dígitos de value > 0 (finito): value ~= digits * 10^K, com até 17 dígitos
+// (Grisu3). Retorna -1 nos poucos casos em que a aritmética de 64 bits não
+// basta para garantir a menor representação.
+static int grisu3(double value, char *digits, int *length, int *K) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    int biased = (int)((bits >> 52) & 0x7FF);
+    uint64_t significand = bits & ((1ULL << 52) - 1);
+    DiyFp v = biased ? (DiyFp){significand | (1ULL << 52), biased - 1075} : (DiyFp){significand, -1074};
+
+    // fronteiras do intervalo que arredonda para value
+    DiyFp plus = diyfp_normalize((DiyFp){(v.f << 1) + 1, v.e - 1});
+    DiyFp minus = v.f == (1ULL << 52) ? (DiyFp){(v.f << 2) - 1, v.e - 2} : (DiyFp){(v.f << 1) - 1, v.e - 1};
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+
+    DiyFp c = cached_power(plus.e, K);
+    DiyFp w = diyfp_multiply(diyfp_normalize(v), c);
+    DiyFp wp = diyfp_multiply(plus, c);
+    DiyFp wm = diyfp_multiply(minus, c);
+    // cada produto erra em até meia unidade: o intervalo inseguro cobre o erro
+    wm.f--;
+    wp.f++;
+    return grisu_digits(wm, w, wp, digits, length, K);
+}
+
+// Valor de precision dígitos que volta a value, se existe: o arredondado
+// corretamente por snprintf ou, se ele cair fora do intervalo de value
+// (fronteira assimétrica ou empate), o vizinho do outro lado de value
+static int shortest_probe(double value, int precision, uint64_t *mantissa, int *exponent) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.*e", precision - 1, value);
+    uint64_t m = 0;
+    const char *p = text;
+    for (; *p != 'e'; p++) {
+        if (*p != '.') {
+            m = m * 10 + (uint64_t)(*p - '0');
+        }
+    }
+    *exponent = atoi(p + 1) - (precision - 1);
+    double rounded = strtod(text, NULL);
+    if (rounded != value) {
+        m = rounded > value ? m - 1 : m + 1;
+        snprintf(text, sizeof(text), "%llue%d", (unsigned long long)m, *exponent);
+        if (!m || strtod(text, NULL) != value) {
+            return 0;
+        }
+    }
+    *mantissa = m;
+    return 1;
+}
+
+// Caminho exato para quando grisu3 não tem certeza. Se existe um valor de
+// n dígitos que volta a value, existe um de n + 1, então o menor número de
+// dígitos é achado por busca binária (17 sempre basta). guess é o tamanho
+// dado por grisu3, quase sempre o certo ou um a mais: guess - 1 e guess são
+// testados antes da busca.
+static void shortest_exact(double value, int guess, char *digits, int *length, int *K) {
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int low = 1, high = 17; // o menor tamanho com solução está em [low, high]
+    int found = 0;          // mantissa e exponent guardam a solução de tamanho high
+    int middle = guess > 1 && guess <= 17 ? guess - 1 : 9;
+    while (low < high) {
+        uint64_t m;
+        int e;
+        if (shortest_probe(value, middle, &m, &e)) {
+            high = middle;
+            mantissa = m;
+            exponent = e;
+            found = 1;
+            middle = (low + high) / 2;
+        } else {
+            low = middle + 1;
+            middle = low == guess && guess < high ? guess : (low + high) / 2;
+        }
+    }
+    if (!found) {
+        shortest_probe(value, high, &mantissa, &exponent);
+    }
+    while (mantissa % 10 == 0) {
+        mantissa /= 10;
+        exponent++;
+    }
+    *length = snprintf(digits, 20, "%llu", (unsigned long long)mantissa);
+    *K = exponent;
+}
+
+static int write_exponent(int exponent, char *out) {
+    char *p = out;
+    *p++ = 'e';
+    if (exponent < 0) {
+        *p++ = '-';
+        exponent = -exponent;
+    }
+    if (exponent >= 100) {
+        *p++ = (char)('0' + exponent / 100);
+        exponent %= 100;
+        *p++ = (char)('0' + exponent / 10);
+    } else if (exponent >= 10) {
+        *p++ = (char)('0' + exponent / 10);
+    }
+    *p++ = (char)('0' + exponent % 10);
+    return (int)(p - out);
+}
+
+// Menor representação de value que volta exatamente ao mesmo double; entre
+// as de mesmo tamanho, a mais próxima de value
+static int format_shortest(double value, char *out) {
+    char *p = out;
+    if (isnan(value)) {
+        memcpy(p, "nan", 3);
+        return 3;
+    }
+    if (signbit(value)) {
+        *p++ = '-';
+        value = -value;
+    }
+    if (isinf(value)) {
+        memcpy(p, "inf", 3);
+        return (int)(p - out) + 3;
+    }
+    if (value == 0) {
+        *p++ = '0';
+        return (int)(p - out);
+    }
+
+    char digits[20];
+    int length, K;
+    if (grisu3(value, digits, &length, &K) != 0) {
+        shortest_exact(value, length, digits, &length, &K);
+    }
+    int point = length + K; // value = 0.d1d2...dn * 10^point
+
+    if (K >= 0 && point <= 21) {
+        // inteiro: 1234e7 -> 12340000000
+        memcpy(p, digits, length);
+        memset(p + length, '0', K);
+        p += point;
+    } else if (point > 0 && point <= 21) {
+        // 1234e-2 -> 12.34
+        memcpy(p, digits, point);
+        p[point] = '.';
+        memcpy(p + point + 1, digits + point, length - point);
+        p += length + 1;
+    } else if (point > -6 && point <= 0) {
+        // 1234e-6 -> 0.001234
+        *p++ = '0';
+        *p++ = '.';
+        memset(p, '0', -point);
+        p += -point;
+        memcpy(p, digits, length);
+        p += length;
+    } else {
+        // notação científica: 1234e30 -> 1.234e33
+        *p++ = digits[0];
+        if (length > 1) {
+            *p++ = '.';
+            memcpy(p, digits + 1, length - 1);
+            p += length - 1;
+        }
+        p += write_exponent(point - 1, p);
+    }
+    return (int)(p - out);
+}
+
+// value com decimals casas decimais (0 a 17), o mesmo texto de "%.*f":
+// arredonda o produto value * 10^decimals, e só recorre a snprintf quando o
+// produto não cabe num double ou cai perto demais de um empate para que o
+// erro da multiplicação possa ser ignorado (acima de 1e17, sai a
+// representação mais curta)
+static int format_fixed(double value, int decimals, char *out) {
+    double scaled = value * (double)pow10_u64[decimals];
+    if (!(fabs(scaled) < 9007199254740992.0) ||
+        fabs(scaled - floor(scaled) - 0.5) <= fabs(scaled) * 0x1p-52) {
+        if (!isfinite(value) || fabs(value) >= 1e17) {
+            return format_shortest(value, out);
+        }
+        return snprintf(out, TXT_NUMBER_MAX, "%.*f", decimals, value);
+    }
+    long long rounded = llrint(scaled);
+    uint64_t magnitude = rounded < 0 ? (uint64_t)-rounded : (uint64_t)rounded;
+
+    char reversed[24];
+    int count = 0;
+    do {
+        reversed[count++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude || count <= decimals);
+
+    char *p = out;
+    if (signbit(value)) {
+        *p++ = '-';
+    }
+    while (count > 0) {
+        if (count == decimals) {
+            *p++ = '.';
+        }
+        *p++ = reversed[--count];
+    }
+    return (int)(p - out);
+}
+
+static int format_number(double value, int precision, char *out) {
+    return precision < 0 ? format_shortest(value, out) : format_fixed(value, precision, out);
+}
+
+// Arquivo texto com buffer próprio: as linhas são montadas na memória e
+// gravadas em blocos de TXT_BUFFER_SIZE bytes
+typedef struct {
+    FILE *fp;
+    char *data;
+    size_t length;
+    uint64_t written; // bytes já gravados
+    int precision;    // casas decimais (-1 = menor representação exata)
+} TextBuffer;
+
+static int text_open(TextBuffer *text, const char *filename, int precision) {
+    text->fp = fopen(filename, "w");
+    text->precision = precision;
+    text->data = pages_alloc(TXT_BUFFER_SIZE);
+    text->length = 0;
+    text->written = 0;
+    if (!text->fp || !text->data) {
+        if (text->fp) {
+            fclose(text->fp);
+        }
+        pages_free(text->data, TXT_BUFFER_SIZE);
+        text->fp = NULL;
+        text->data = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static void text_flush(TextBuffer *text) {
+    fwrite(text->data, 1, text->length, text->fp);
+    text->written += text->length;
+    text->length = 0;
+}
+
+// Uma linha "real imag" por coeficiente
+static void text_write_values(TextBuffer *text, const Complex *values, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (text->length > TXT_BUFFER_SIZE - 2 * TXT_NUMBER_MAX - 2) {
+            text_flush(text);
+        }
+        char *p = text->data + text->length;
+        p += format_number(values[i].real, text->precision, p);
+        *p++ = ' ';
+        p += format_number(values[i].imag, text->precision, p);
+        *p++ = '\n';
+        text->length = p - text->data;
+    }
+}
+
+static void text_close(TextBuffer *text) {
+    if (text->fp) {
+        text_flush(text);
+        fclose(text->fp);
+        pages_free(text->data, TXT_BUFFER_SIZE);
+        text->fp = NULL;
+        text->data = NULL;
+    }
+}
+
+// FNV-1a de 64 bits, acumulável em partes a partir de FNV_OFFSET
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t bytes) {
+    const uint8_t *p = data;
+    for (size_t i = 0; i < bytes; i++) {
+        hash = (hash ^ p[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+// Arquivo único (--archive). Um registro é anexado em três passos: o espaço
+// é reservado no fim do arquivo, o conteúdo é gravado e levado ao disco, e só
+// então a entrada do índice passa a apontar para ele. Uma interrupção no meio
+// deixa no máximo um registro sem entrada, nunca uma entrada para dados
+// incompletos. O índice é dividido em blocos de ARCHIVE_BLOCK_ENTRIES
+// entradas, encadeados; a chave (imagem - 1) * 3 + canal diz o bloco e a
+// entrada, e as posições dos blocos ficam na memória: a consulta é O(1).
+
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_BLOCK_ENTRIES 2046 // bloco de índice com 64 KB
+#define ARCHIVE_BLOCK_BYTES (sizeof(ArchiveBlockHeader) + ARCHIVE_BLOCK_ENTRIES * sizeof(ArchiveEntry))
+
+typedef struct {
+    DiskFile file;
+    pthread_mutex_t lock;
+    uint64_t end;     // onde o próximo registro ou bloco será anexado
+    uint64_t *blocks; // posição de cada bloco do índice, na ordem das chaves
+    int block_count;
+    int block_capacity;
+} Archive;
+
+static Archive *archive = NULL; // aberto em options.archive_path durante o lote
+
+static uint64_t align64(uint64_t n) {
+    return (n + 63) & ~(uint64_t)63;
+}
+
+static uint64_t archive_entry_checksum(const ArchiveEntry *entry) {
+    uint64_t hash = fnv1a(FNV_OFFSET, &entry->offset, sizeof(entry->offset));
+    return fnv1a(hash, &entry->size, sizeof(entry->size));
+}
+
+static int archive_push_block(Archive *ar, uint64_t offset) {
+    if (ar->block_count == ar->block_capacity) {
+        int capacity = ar->block_capacity ? 2 * ar->block_capacity : 16;
+        uint64_t *blocks = realloc(ar->blocks, capacity * sizeof(uint64_t));
+        if (!blocks) {
+            return -1;
+        }
+        ar->blocks = blocks;
+        ar->block_capacity = capacity;
+    }
+    ar->blocks[ar->block_count++] = offset;
+    return 0;
+}
+
+// Anexa um bloco de índice vazio e o encadeia ao último (chamado com o lock)
+static int archive_add_block(Archive *ar) {
+    uint8_t *block = calloc(1, ARCHIVE_BLOCK_BYTES);
+    if (!block) {
+        return -1;
+    }
+    ArchiveBlockHeader *header = (ArchiveBlockHeader *)block;
+    memcpy(header->magic, "IMGFIDX", 8);
+    header->first_key = (uint32_t)ar->block_count * ARCHIVE_BLOCK_ENTRIES;
+
+    uint64_t offset = ar->end;
+    int status = disk_io(&ar->file, block, ARCHIVE_BLOCK_BYTES, offset, 1);
+    free(block);
+    // o bloco precisa estar no disco antes de ser encadeado
+    if (status != 0 || disk_sync(&ar->file) != 0) {
+        return -1;
+    }
+    ar->end += ARCHIVE_BLOCK_BYTES;
+
+    uint64_t link = ar->block_count ? ar->blocks[ar->block_count - 1] + offsetof(ArchiveBlockHeader, next_block)
+                                    : offsetof(ArchiveHeader, first_block);
+    if (disk_io(&ar->file, &offset, sizeof(offset), link, 1) != 0) {
+        return -1;
+    }
+    return archive_push_block(ar, offset);
+}
+
+// Abre (ou cria) o arquivo único; registros de execuções anteriores são
+// mantidos, e um novo registro da mesma imagem e canal substitui o antigo
+static int archive_open(const char *filename) {
+    Archive *ar = calloc(1, sizeof(Archive));
+    if (!ar || disk_open(&ar->file, filename) != 0) {
+        perror("Erro ao abrir arquivo unico");
+        free(ar);
+        return -1;
+    }
+    pthread_mutex_init(&ar->lock, NULL);
+
+    ArchiveHeader header;
+    const char *error = NULL;
+    uint64_t size = disk_size(&ar->file);
+    if (size == 0) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "IMGFARCH", 8);
+        header.version = ARCHIVE_VERSION;
+        header.block_entries = ARCHIVE_BLOCK_ENTRIES;
+        if (disk_io(&ar->file, &header, sizeof(header), 0, 1) != 0 || disk_sync(&ar->file) != 0) {
+            error = "falha ao gravar o cabecalho";
+        }
+        ar->end = sizeof(header);
+    } else if (size < sizeof(header) || disk_io(&ar->file, &header, sizeof(header), 0, 0) != 0 ||
+               memcmp(header.magic, "IMGFARCH", 8) != 0 || header.version != ARCHIVE_VERSION ||
+               header.block_entries != ARCHIVE_BLOCK_ENTRIES) {
+        error = "cabecalho invalido";
+    } else {
+        // o que houver depois do fim atual (um registro interrompido) é só espaço perdido
+        ar->end = align64(size);
+        uint64_t offset = header.first_block;
+        while (offset && !error) {
+            ArchiveBlockHeader block;
+            if (offset + ARCHIVE_BLOCK_BYTES > size ||
+                disk_io(&ar->file, &block, sizeof(block), offset, 0) != 0 ||
+                memcmp(block.magic, "IMGFIDX", 8) != 0 ||
+                block.first_key != (uint32_t)ar->block_count * ARCHIVE_BLOCK_ENTRIES) {
+                error = "bloco de indice invalido";
+            } else if (archive_push_block(ar, offset) != 0) {
+                error = "sem memoria para o indice";
+            }
+            offset = block.next_block;
+        }
+    }
+
+    if (error) {
+        fprintf(stderr, "Arquivo unico invalido (%s): %s\n", error, filename);
+        disk_close(&ar->file);
+        pthread_mutex_destroy(&ar->lock);
+        free(ar->blocks);
+        free(ar);
+        return -1;
+    }
+    archive = ar;
+    return 0;
+}
+
+static void archive_close(void) {
+    if (!archive) {
+        return;
+    }
+    disk_sync(&archive->file);
+    disk_close(&archive->file);
+    pthread_mutex_destroy(&archive->lock);
+    free(archive->blocks);
+    free(archive);
+    archive = NULL;
+}
+
+// Reserva bytes bytes no fim do arquivo para um registro
+static uint64_t archive_reserve(Archive *ar, uint64_t bytes) {
+    pthread_mutex_lock(&ar->lock);
+    uint64_t offset = ar->end;
+    ar->end += align64(bytes);
+    pthread_mutex_unlock(&ar->lock);
+    return offset;
+}
+
+static int archive_write(Archive *ar, const void *data, size_t bytes, uint64_t offset) {
+    pthread_mutex_lock(&ar->lock);
+    int status = disk_io(&ar->file, (void *)data, bytes, offset, 1);
+    pthread_mutex_unlock(&ar->lock);
+    return status;
+}
+
+// Torna visível no índice o registro já gravado em offset
+static int archive_commit(Archive *ar, int image_index, int channel, uint64_t offset, uint64_t size) {
+    if (disk_sync(&ar->file) != 0) {
+        return -1;
+    }
+    uint32_t key = (uint32_t)(image_index - 1) * 3 + channel;
+    int block = (int)(key / ARCHIVE_BLOCK_ENTRIES);
+
+    ArchiveEntry entry = {offset, size, 0, 0};
+    entry.checksum = archive_entry_checksum(&entry);
+
+    int status = 0;
+    pthread_mutex_lock(&ar->lock);
+    while (status == 0 && ar->block_count <= block) {
+        status = archive_add_block(ar);
+    }
+    if (status == 0) {
+        uint64_t position = ar->blocks[block] + sizeof(ArchiveBlockHeader) +
+                            (uint64_t)(key % ARCHIVE_BLOCK_ENTRIES) * sizeof(ArchiveEntry);
+        status = disk_io(&ar->file, &entry, sizeof(entry), position, 1);
+    }
+    pthread_mutex_unlock(&ar->lock);
+    return status;
+}
+
+// Procura o registro de uma imagem e canal: posição e tamanho do .dat
+// guardado nele. Retorna -1 se ele não existe.
+static int archive_find(int image_index, int channel, uint64_t *data_offset, uint64_t *data_bytes) {
+    uint32_t key = (uint32_t)(image_index - 1) * 3 + channel;
+    int block = (int)(key / ARCHIVE_BLOCK_ENTRIES);
+    ArchiveEntry entry;
+    ArchiveRecord record;
+
+    pthread_mutex_lock(&archive->lock);
+    int status = -1;
+    if (image_index >= 1 && block < archive->block_count &&
+        disk_io(&archive->file, &entry, sizeof(entry), archive->blocks[block] + sizeof(ArchiveBlockHeader) +
+                (uint64_t)(key % ARCHIVE_BLOCK_ENTRIES) * sizeof(ArchiveEntry), 0) == 0 &&
+        entry.offset && entry.checksum == archive_entry_checksum(&entry) &&
+        disk_io(&archive->file, &record, sizeof(record), entry.offset, 0) == 0 &&
+        memcmp(record.magic, "IMGFREC", 8) == 0) {
+        *data_offset = entry.offset + sizeof(ArchiveRecord);
+        *data_bytes = record.data_bytes;
+        status = 0;
+    }
+    pthread_mutex_unlock(&archive->lock);
+    return status;
+}
+
+// Esvazia a entrada de uma imagem e canal; o registro vira espaço perdido
+static int archive_remove(int image_index, int channel) {
+    uint32_t key = (uint32_t)(image_index - 1) * 3 + channel;
+    int block = (int)(key / ARCHIVE_BLOCK_ENTRIES);
+    ArchiveEntry entry = {0, 0, 0, 0};
+
+    pthread_mutex_lock(&archive->lock);
+    int status = 0;
+    if (image_index >= 1 && block < archive->block_count) {
+        uint64_t position = archive->blocks[block] + sizeof(ArchiveBlockHeader) +
+                            (uint64_t)(key % ARCHIVE_BLOCK_ENTRIES) * sizeof(ArchiveEntry);
+        status = disk_io(&archive->file, &entry, sizeof(entry), position, 1);
+    }
+    pthread_mutex_unlock(&archive->lock);
+    return status;
+}
+
+#define SPECTRUM_VERSION 1
+#define SPECTRUM_ALIGN 64        // alinhamento dos coeficientes no .dat
+#define SPECTRUM_CHUNK_VALUES 512 // coeficientes convertidos por vez
+
+// Disposição das linhas gravadas
+enum {
+    SPECTRUM_HALF, // width/2 + 1 colunas não redundantes
+    SPECTRUM_FULL  // todas as width colunas
+};
+
+// Como os espectros são gravados: no programa vem das opções, na biblioteca
+// do contexto
+typedef struct {
+    int full_spectrum; // height x width coeficientes em vez do meio espectro
+    int dat_format;    // SPECTRUM_FLOAT64, _FLOAT32, _FLOAT16 ou _RAW
+    int txt_precision; // casas decimais do .txt (-1 = menor representação exata)
+    Archive *archive;  // arquivo único que recebe os .dat (NULL = arquivos separados)
+    int verbose;       // anuncia cada .txt gravado na saída padrão
+} SpectrumSettings;
+
+// Destino do espectro de um canal
+typedef struct {
+    int channel;
+    int image_index;
+    const char *source; // BMP de origem
+    const char *dat_filename; // NULL: sem .dat
+    const char *txt_filename; // NULL: sem .txt
+    ImageMetrics *metrics;    // NULL: sem medições
+    const SpectrumSettings *settings;
+} SpectrumOutput;
+
+// Gravação pedida na linha de comando, com o arquivo único se estiver aberto
+static SpectrumSettings program_spectrum_settings(void) {
+    SpectrumSettings settings = {options.full_spectrum, options.dat_format, options.txt_precision, archive, 1};
+    return settings;
+}
+
+// Saída de um espectro em .dat e .txt, gravada em partes à medida que as
+// linhas ficam prontas. Com o arquivo único aberto, o conteúdo do .dat vai
+// para um registro dele e o .txt não é gerado.
+typedef struct {
+    FILE *dat;
+    int format;   // settings->dat_format
+    double scale; // fator aplicado aos coeficientes antes da conversão
+    const SpectrumOutput *output;
+    Archive *archive;
+    int in_archive;      // gravando um registro do arquivo único
+    int failed;          // alguma escrita no registro falhou
+    uint64_t record;     // posição do registro
+    uint64_t position;   // próxima escrita dentro dele
+    uint64_t data_bytes; // tamanho do .dat
+    TextBuffer txt;
+} SpectrumWriter;
+
+// double -> meia precisão IEEE, arredondando para o par mais próximo
+static uint16_t double_to_half(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint16_t sign = (uint16_t)((bits >> 48) & 0x8000);
+    int exponent = (int)((bits >> 52) & 0x7FF);
+    uint64_t mantissa = bits & ((1ULL << 52) - 1);
+
+    if (exponent == 0x7FF) {
+        return sign | 0x7C00 | (mantissa ? 0x200 : 0); // infinito ou NaN
+    }
+    if (fabs(value) >= 65520.0) {
+        return sign | 0x7C00; // acima do maior valor representável
+    }
+
+    uint64_t h, rest, halfway;
+    if (exponent >= 1023 - 14) {
+        // normal: reduz o expoente e os 52 bits de mantissa para 10
+        h = ((uint64_t)(exponent - 1008) << 10) | (mantissa >> 42);
+        rest = mantissa & ((1ULL << 42) - 1);
+        halfway = 1ULL << 41;
+    } else {
+        // subnormal: mantissa inteira (com o bit implícito) em unidades de 2^-24
+        int shift = 1051 - exponent;
+        if (shift > 63) {
+            return sign;
+        }
+        uint64_t full = mantissa | (1ULL << 52);
+        h = full >> shift;
+        rest = full & ((1ULL << shift) - 1);
+        halfway = 1ULL << (shift - 1);
+    }
+    if (rest > halfway || (rest == halfway && (h & 1))) {
+        h++; // o vai-um pode passar para o expoente, o que também está correto
+    }
+    return sign | (uint16_t)h;
+}
+
+static void spectrum_writer_emit(SpectrumWriter *writer, const void *data, size_t bytes) {
+    if (writer->in_archive) {
+        if (!writer->failed && archive_write(writer->archive, data, bytes, writer->position) != 0) {
+            writer->failed = 1;
+        }
+        writer->position += bytes;
+    } else {
+        fwrite(data, 1, bytes, writer->dat);
+    }
+}
+
+static void spectrum_writer_open(SpectrumWriter *writer, const SpectrumOutput *output, int width, int height) {
+    static const size_t component_bytes[] = {sizeof(double), sizeof(float), sizeof(uint16_t), sizeof(double)};
+    const SpectrumSettings *settings = output->settings;
+    writer->archive = settings->archive;
+    writer->format = settings->dat_format;
+    if (writer->archive && writer->format == SPECTRUM_RAW) {
+        writer->format = SPECTRUM_FLOAT64; // no arquivo único o espectro sempre tem cabeçalho
+    }
+    writer->scale = writer->format == SPECTRUM_FLOAT16 ? 1.0 / ((double)width * height) : 1.0;
+    writer->output = output;
+    writer->in_archive = 0;
+    writer->failed = 0;
+    writer->dat = NULL;
+    writer->txt.fp = NULL;
+    double start = metrics_clock();
+
+    uint32_t columns = settings->full_spectrum ? width : width / 2 + 1;
+    uint64_t payload_bytes = (uint64_t)columns * height * 2 * component_bytes[writer->format];
+    writer->data_bytes = payload_bytes + (writer->format == SPECTRUM_RAW ? 0 : sizeof(SpectrumHeader));
+    if (writer->archive) {
+        writer->record = archive_reserve(writer->archive, sizeof(ArchiveRecord) + writer->data_bytes);
+        writer->position = writer->record + sizeof(ArchiveRecord);
+        writer->in_archive = 1;
+    } else if (output->dat_filename) {
+        writer->dat = fopen(output->dat_filename, "wb");
+    }
+
+    if ((writer->dat || writer->in_archive) && writer->format != SPECTRUM_RAW) {
+        SpectrumHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "IMGFSPEC", 8);
+        header.version = SPECTRUM_VERSION;
+        header.header_size = SPECTRUM_ALIGN;
+        header.width = width;
+        header.height = height;
+        header.columns = columns;
+        header.channel = (uint8_t)output->channel;
+        header.layout = settings->full_spectrum ? SPECTRUM_FULL : SPECTRUM_HALF;
+        header.precision = (uint8_t)writer->format;
+        header.scale = writer->scale;
+        header.payload_bytes = payload_bytes;
+        spectrum_writer_emit(writer, &header, sizeof(header));
+    }
+    metrics_add(output->metrics, STAGE_DAT, start);
+
+    start = metrics_clock();
+    if (!writer->archive && output->txt_filename &&
+        text_open(&writer->txt, output->txt_filename, settings->txt_precision) != 0) {
+        perror("Erro ao criar arquivo TXT");
+    }
+    if (writer->txt.fp && output->metrics) {
+        output->metrics->allocations++; // buffer do .txt
+    }
+    metrics_add(output->metrics, STAGE_TXT, start);
+}
+
+// Converte os coeficientes para a precisão do .dat em blocos e os grava
+static void spectrum_writer_write_dat(SpectrumWriter *writer, const Complex *values, size_t count) {
+    // na precisão do cálculo os coeficientes já estão no formato do arquivo
+    int wide = writer->format == SPECTRUM_FLOAT64 || writer->format == SPECTRUM_RAW;
+    if ((wide && sizeof(fft_real) == sizeof(double)) ||
+        (writer->format == SPECTRUM_FLOAT32 && sizeof(fft_real) == sizeof(float))) {
+        spectrum_writer_emit(writer, values, count * sizeof(Complex));
+        return;
+    }
+
+    double full[2 * SPECTRUM_CHUNK_VALUES];
+    float single[2 * SPECTRUM_CHUNK_VALUES];
+    uint16_t half[2 * SPECTRUM_CHUNK_VALUES];
+    for (size_t i = 0; i < count; i += SPECTRUM_CHUNK_VALUES) {
+        size_t n = count - i < SPECTRUM_CHUNK_VALUES ? count - i : SPECTRUM_CHUNK_VALUES;
+        if (wide) {
+            for (size_t k = 0; k < n; k++) {
+                full[2 * k] = values[i + k].real;
+                full[2 * k + 1] = values[i + k].imag;
+            }
+            spectrum_writer_emit(writer, full, 2 * n * sizeof(double));
+        } else if (writer->format == SPECTRUM_FLOAT32) {
+            for (size_t k = 0; k < n; k++) {
+                single[2 * k] = (float)values[i + k].real;
+                single[2 * k + 1] = (float)values[i + k].imag;
+            }
+            spectrum_writer_emit(writer, single, 2 * n * sizeof(float));
+        } else {
+            for (size_t k = 0; k < n; k++) {
+                half[2 * k] = double_to_half(values[i + k].real * writer->scale);
+                half[2 * k + 1] = double_to_half(values[i + k].imag * writer->scale);
+            }
+            spectrum_writer_emit(writer, half, 2 * n * sizeof(uint16_t));
+        }
+    }
+}
+
+static void spectrum_writer_write(SpectrumWriter *writer, const Complex *values, size_t count) {
+    ImageMetrics *metrics = writer->output->metrics;
+    if (writer->dat || writer->in_archive) {
+        double start = metrics_clock();
+        spectrum_writer_write_dat(writer, values, count);
+        metrics_add(metrics, STAGE_DAT, start);
+    }
+    if (writer->txt.fp) {
+        double start = metrics_clock();
+        text_write_values(&writer->txt, values, count);
+        metrics_add(metrics, STAGE_TXT, start);
+    }
+}
+
+static void spectrum_writer_close(SpectrumWriter *writer) {
+    const SpectrumOutput *output = writer->output;
+    ImageMetrics *metrics = output->metrics;
+    double start = metrics_clock();
+    if (metrics && (writer->dat || writer->in_archive)) {
+        metrics->bytes_written += writer->data_bytes + (writer->in_archive ? sizeof(ArchiveRecord) : 0);
+    }
+    if (writer->dat) {
+        fclose(writer->dat);
+    }
+    if (writer->in_archive) {
+        // o cabeçalho do registro é gravado por último, e a entrada do índice depois dele
+        ArchiveRecord record;
+        memset(&record, 0, sizeof(record));
+        memcpy(record.magic, "IMGFREC", 8);
+        record.image_index = output->image_index;
+        record.channel = output->channel;
+        record.data_bytes = writer->data_bytes;
+        strncpy(record.source, output->source, sizeof(record.source) - 1);
+        if (writer->failed || writer->position != writer->record + sizeof(record) + writer->data_bytes ||
+            archive_write(writer->archive, &record, sizeof(record), writer->record) != 0 ||
+            archive_commit(writer->archive, output->image_index, output->channel, writer->record,
+                           sizeof(record) + writer->data_bytes) != 0) {
+            perror("Erro ao gravar no arquivo unico");
+        }
+    }
+    metrics_add(metrics, STAGE_DAT, start);
+    if (writer->txt.fp) {
+        start = metrics_clock();
+        if (output->settings->verbose) {
+            printf("Gerando arquivo txt do arquivo : %s\n", output->txt_filename);
+        }
+        text_close(&writer->txt);
+        if (metrics) {
+            metrics->bytes_written += writer->txt.written;
+        }
+        metrics_add(metrics, STAGE_TXT, start);
+    }
+    writer->dat = NULL;
+    writer->in_archive = 0;
+}
+
+// Grava o espectro em .dat e .txt: por padrão só as width/2 + 1 colunas não
+// redundantes de cada linha; com settings->full_spectrum, height x width
+// Retorna -1 se faltar memória ou um dos arquivos pedidos não puder ser criado
+static int save_spectrum(Workspace *ws, Complex *half_spectrum, int width, int height, const SpectrumOutput *output) {
+    Complex *out = half_spectrum;
+    size_t N = (size_t)(width / 2 + 1) * height;
+
+    if (output->settings->full_spectrum) {
+        N = (size_t)width * height;
+        out = workspace_get(ws, WS_FULL, N * sizeof(Complex));
+        if (!out) {
+            perror("Erro ao alocar memoria para o espectro");
+            return -1;
+        }
+        expand_half_spectrum(half_spectrum, out, width, height);
+    }
+
+    SpectrumWriter writer;
+    spectrum_writer_open(&writer, output, width, height);
+    int status = !writer.archive && ((output->dat_filename && !writer.dat) || (output->txt_filename && !writer.txt.fp))
+                     ? -1 : 0;
+    spectrum_writer_write(&writer, out, N);
+    spectrum_writer_close(&writer);
+    return status;
+}
+
+// Pixels de uma sequência de colunas seguidas da imagem do espectro:
+// out[k] recebe o nível levels[c][first + k * step] de cada canal, já
+// normalizado. step é 1 na metade guardada do espectro e -1 na espelhada.
+static void spectrum_bmp_run(RGB *out, const fft_real *red, const fft_real *green, const fft_real *blue,
+                             const fft_real *scale, ptrdiff_t first, int step, int count) {
+    if (step > 0) {
+        for (int k = 0; k < count; k++) {
+            out[k].red = (uint8_t)(red[first + k] * scale[CHANNEL_RED] + 0.5);
+            out[k].green = (uint8_t)(green[first + k] * scale[CHANNEL_GREEN] + 0.5);
+            out[k].blue = (uint8_t)(blue[first + k] * scale[CHANNEL_BLUE] + 0.5);
+        }
+    } else {
+        for (int k = 0; k < count; k++) {
+            out[k].red = (uint8_t)(red[first - k] * scale[CHANNEL_RED] + 0.5);
+            out[k].green = (uint8_t)(green[first - k] * scale[CHANNEL_GREEN] + 0.5);
+            out[k].blue = (uint8_t)(blue[first - k] * scale[CHANNEL_BLUE] + 0.5);
+        }
+    }
+}
+
+// Imagem do espectro (--spectrum-bmp): log(1 + |F|) de cada canal na
+// componente de mesma cor, com a frequência zero no centro (fftshift) e
+// normalizado para 0..255 pelo maior valor do canal. Os logaritmos são
+// calculados uma única vez, sobre o meio espectro, em WS_MAGNITUDE; a outra
+// metade da imagem vem de |F[v][u]| = |F[-v][-u]|. Cada linha é montada em
+// trechos de colunas seguidas, sem teste por pixel.
+static void write_spectrum_bmp(Workspace *ws, const char *filename, Complex **spectra, int width, int height) {
+    int half = width / 2 + 1;
+    size_t half_len = (size_t)half * height;
+    RGB *pixels = workspace_get(ws, WS_PIXELS, (size_t)width * height * sizeof(RGB));
+    fft_real *levels = workspace_get(ws, WS_MAGNITUDE, 3 * half_len * sizeof(fft_real));
+    if (!pixels || !levels) {
+        perror("Erro ao alocar memoria para a imagem do espectro");
+        return;
+    }
+
+    fft_real scale[3];
+    for (int c = 0; c < 3; c++) {
+        const Complex *values = spectra[c];
+        fft_real *magnitude = levels + c * half_len;
+        fft_real peak = 0;
+        for (size_t i = 0; i < half_len; i++) {
+            magnitude[i] = log1p(sqrt(values[i].real * values[i].real + values[i].imag * values[i].imag));
+            peak = magnitude[i] > peak ? magnitude[i] : peak;
+        }
+        scale[c] = peak > 0 ? 255 / peak : 0;
+    }
+    const fft_real *red = levels + CHANNEL_RED * half_len;
+    const fft_real *green = levels + CHANNEL_GREEN * half_len;
+    const fft_real *blue = levels + CHANNEL_BLUE * half_len;
+
+    // a linha y mostra a frequência v = y - height/2 e a coluna x, u = x - width/2;
+    // u < half vem da linha v do meio espectro e u >= half, da coluna
+    // width - u da linha espelhada
+    for (int y = 0; y < height; y++) {
+        int v = (y + height - height / 2) % height;
+        ptrdiff_t row = (ptrdiff_t)v * half;
+        ptrdiff_t mirror = (ptrdiff_t)((height - v) % height) * half;
+        RGB *out = pixels + (size_t)y * width;
+        int u = (width - width / 2) % width;
+        for (int x = 0; x < width;) {
+            int count;
+            if (u < half) {
+                count = half - u < width - x ? half - u : width - x;
+                spectrum_bmp_run(out + x, red, green, blue, scale, row + u, 1, count);
+            } else {
+                count = width - u < width - x ? width - u : width - x;
+                spectrum_bmp_run(out + x, red, green, blue, scale, mirror + (width - u), -1, count);
+            }
+            x += count;
+            u = (u + count) % width;
+        }
+    }
+    write_bmp(filename, pixels, width, height);
+}
+
+// Transforma os três planos de uma imagem nos meios espectros spectra[c]:
+// as linhas e colunas de todos eles são divididas entre as threads do pool.
+// Com options.pack_channels, vermelho e verde compartilham uma FFT complexa.
+static int transform_channels(Workspace *ws, fft_real **planes, Complex **spectra, int width, int height) {
+    ThreadPool *pool = workspace_pool(ws);
+    int nthreads = pool_threads(pool);
+
+    if (!options.pack_channels) {
+        size_t scratch_len = fft2d_batch_scratch_len(FFT2D_R2C, width, height, 3, nthreads);
+        Complex *scratch = scratch_len ? workspace_get(ws, WS_SCRATCH, scratch_len * sizeof(Complex)) : NULL;
+        if (!scratch) {
+            perror("Erro ao alocar memoria para a FFT");
+            return -1;
+        }
+        // entrada real: basta calcular a metade não redundante do espectro 2D
+        return fft2d_batch(pool, FFT2D_R2C, 3, planes, spectra, scratch, width, height);
+    }
+
+    size_t N = (size_t)width * height;
+    size_t pair_len = fft2d_batch_scratch_len(FFT2D_FORWARD, width, height, 1, nthreads);
+    size_t blue_len = fft2d_batch_scratch_len(FFT2D_R2C, width, height, 1, nthreads);
+    if (pair_len == 0 || blue_len == 0) {
+        return -1;
+    }
+    Complex *packed = workspace_get(ws, WS_PACKED, N * sizeof(Complex));
+    Complex *scratch = workspace_get(ws, WS_SCRATCH, max_size(pair_len, blue_len) * sizeof(Complex));
+    if (!packed || !scratch) {
+        perror("Erro ao alocar memoria para a FFT");
+        return -1;
+    }
+    if (fft2d_pair(pool, planes[CHANNEL_RED], planes[CHANNEL_GREEN], spectra[CHANNEL_RED],
+                   spectra[CHANNEL_GREEN], packed, scratch, width, height) != 0) {
+        return -1;
+    }
+    return fft2d_batch(pool, FFT2D_R2C, 1, planes + CHANNEL_BLUE, spectra + CHANNEL_BLUE, scratch, width, height);
+}
+
+// Filtros no domínio da frequência (--filter): máscaras reais e simétricas
+// aplicadas ao meio espectro antes da inversa, sem gravar espectros. As
+// frequências são em ciclos por pixel (0 a 0.5 em cada eixo) e vários
+// filtros se multiplicam.
+enum {
+    FILTER_LOWPASS,  // lowpass:R, mantém |f| <= R
+    FILTER_HIGHPASS, // highpass:R, mantém |f| > R
+    FILTER_BANDPASS, // bandpass:R1:R2, mantém R1 <= |f| <= R2
+    FILTER_GAUSSIAN, // gaussian:S, passa-baixa exp(-|f|^2 / 2S^2)
+    FILTER_NOTCH     // notch:FX:FY:R, zera os discos de raio R em (FX, FY) e (-FX, -FY)
+};
+
+typedef struct {
+    int type;
+    double a, b, c; // parâmetros, na ordem da linha de comando
+} Filter;
+
+#define MAX_FILTERS 8
+
+static Filter filters[MAX_FILTERS];
+static int filter_count = 0;
+
+// Acrescenta um filtro no formato "tipo:parametro[:parametro...]"
+static PROGRAM_ONLY int parse_filter(const char *spec) {
+    static const struct {
+        const char *name;
+        int type;
+        int params;
+    } kinds[] = {
+        {"lowpass", FILTER_LOWPASS, 1},   {"highpass", FILTER_HIGHPASS, 1}, {"bandpass", FILTER_BANDPASS, 2},
+        {"gaussian", FILTER_GAUSSIAN, 1}, {"notch", FILTER_NOTCH, 3},
+    };
+    if (filter_count == MAX_FILTERS) {
+        fprintf(stderr, "No maximo %d filtros\n", MAX_FILTERS);
+        return -1;
+    }
+    const char *colon = strchr(spec, ':');
+    size_t length = colon ? (size_t)(colon - spec) : strlen(spec);
+    for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+        if (strlen(kinds[k].name) != length || strncmp(spec, kinds[k].name, length) != 0) {
+            continue;
+        }
+        double p[3] = {0, 0, 0};
+        int end = 0;
+        int found = 0;
+        if (colon) {
+            found = sscanf(colon + 1, "%lf%n:%lf%n:%lf%n", &p[0], &end, &p[1], &end, &p[2], &end);
+        }
+        int valid = colon && found == kinds[k].params && colon[1 + end] == '\0';
+        switch (kinds[k].type) {
+        case FILTER_BANDPASS:
+            valid = valid && p[0] >= 0 && p[0] <= p[1];
+            break;
+        case FILTER_GAUSSIAN:
+            valid = valid && p[0] > 0;
+            break;
+        case FILTER_NOTCH:
+            valid = valid && p[2] >= 0; // o centro pode ter coordenadas negativas
+            break;
+        default:
+            valid = valid && p[0] >= 0;
+            break;
+        }
+        if (!valid) {
+            break;
+        }
+        filters[filter_count].type = kinds[k].type;
+        filters[filter_count].a = p[0];
+        filters[filter_count].b = p[1];
+        filters[filter_count].c = p[2];
+        filter_count++;
+        return 0;
+    }
+    fprintf(stderr, "Filtro invalido: %s\n", spec);
+    return -1;
+}
+
+static double filter_gain(double fx, double fy) {
+    double r = sqrt(fx * fx + fy * fy);
+    double gain = 1.0;
+    for (int i = 0; i < filter_count; i++) {
+        const Filter *f = &filters[i];
+        switch (f->type) {
+        case FILTER_LOWPASS:
+            gain *= r <= f->a;
+            break;
+        case FILTER_HIGHPASS:
+            gain *= r > f->a;
+            break;
+        case FILTER_BANDPASS:
+            gain *= r >= f->a && r <= f->b;
+            break;
+        case FILTER_GAUSSIAN:
+            gain *= exp(-r * r / (2 * f->a * f->a));
+            break;
+        case FILTER_NOTCH:
+            gain *= hypot(fx - f->a, fy - f->b) > f->c && hypot(fx + f->a, fy + f->b) > f->c;
+            break;
+        }
+    }
+    return gain;
+}
+
+// Máscara do meio espectro, já com a normalização 1 / (width * height) da
+// inversa; calculada uma vez por tamanho de imagem e guardada no workspace
+static const fft_real *filter_mask(Workspace *ws, int width, int height) {
+    int columns = width / 2 + 1;
+    fft_real *mask = workspace_get(ws, WS_MASK, (size_t)columns * height * sizeof(fft_real));
+    if (!mask || (ws->mask_width == width && ws->mask_height == height)) {
+        return mask;
+    }
+    double scale = 1.0 / ((double)width * height);
+    for (int v = 0; v < height; v++) {
+        double fy = (double)(v <= height / 2 ? v : v - height) / height;
+        for (int u = 0; u < columns; u++) {
+            mask[(size_t)v * columns + u] = filter_gain((double)u / width, fy) * scale;
+        }
+    }
+    ws->mask_width = width;
+    ws->mask_height = height;
+    return mask;
+}
+
+// Aplica os filtros aos três meios espectros e volta ao domínio do espaço,
+// sobrescrevendo os planos de entrada (os espectros também são sobrescritos)
+static int filter_channels(Workspace *ws, Complex **spectra, fft_real **planes, int width, int height) {
+    ThreadPool *pool = workspace_pool(ws);
+    size_t scratch_len = fft2d_batch_scratch_len(FFT2D_C2R, width, height, 3, pool_threads(pool));
+    const fft_real *mask = filter_mask(ws, width, height);
+    Complex *scratch = scratch_len ? workspace_get(ws, WS_SCRATCH, scratch_len * sizeof(Complex)) : NULL;
+    if (!mask || !scratch) {
+        perror("Erro ao alocar memoria para o filtro");
+        return -1;
+    }
+    size_t half_len = (size_t)(width / 2 + 1) * height;
+    for (int c = 0; c < 3; c++) {
+        Complex *spectrum = spectra[c];
+        for (size_t i = 0; i < half_len; i++) {
+            spectrum[i].real *= mask[i];
+            spectrum[i].imag *= mask[i];
+        }
+    }
+    return fft2d_batch(pool, FFT2D_C2R, 3, planes, spectra, scratch, width, height);
+}
+
+// Convolução e correlação por FFT (--convolve, --correlate). O kernel ou
+// modelo é transformado uma única vez, num bloco de tamanho fixo, e o
+// espectro é reaproveitado em todas as imagens. Cada imagem é percorrida em
+// blocos sobrepostos (overlap-save): transformada do bloco, produto com o
+// espectro do kernel e inversa, da qual só se aproveitam as posições em que
+// a correlação circular não dá a volta.
+enum {
+    MATCH_NONE,
+    MATCH_CONVOLVE,  // imagem convolvida, do mesmo tamanho, com o kernel centrado
+    MATCH_CORRELATE  // picos da correlação cruzada normalizada com o modelo
+};
+
+#define MATCH_MIN_TILE 256 // lado mínimo dos blocos
+#define MAX_PEAKS 64
+
+typedef struct {
+    int x, y; // canto superior esquerdo do modelo na imagem, de cima para baixo
+    double score;
+} MatchPeak;
+
+static struct {
+    int mode;
+    int width, height;           // kernel ou modelo
+    int tile_width, tile_height; // blocos (potências de dois)
+    Complex *spectra;            // conj(espectro) de cada canal, já com a normalização da inversa
+    double norm;                 // norma do modelo sem a média (correlação)
+    int peaks;                   // picos informados por imagem (--peaks)
+    uint64_t source_hash;        // conteúdo do BMP do kernel (manifesto)
+} match_kernel = {MATCH_NONE, 0, 0, 0, 0, NULL, 0, 5, 0};
+
+static int match_tile_size(int kernel_size) {
+    int size = MATCH_MIN_TILE;
+    while (size < 4 * kernel_size) {
+        size *= 2;
+    }
+    return size;
+}
+
+// Lê o kernel (ou modelo) e calcula seu espectro nos blocos
+static PROGRAM_ONLY int match_kernel_load(const char *filename, int mode) {
+    BmpImage img;
+    if (bmp_open(filename, &img) != 0) {
+        return -1;
+    }
+    int kw = img.width;
+    int kh = img.height;
+    int tw = match_tile_size(kw);
+    int th = match_tile_size(kh);
+    size_t K = (size_t)kw * kh;
+    size_t tile = (size_t)tw * th;
+    size_t half_len = (size_t)(tw / 2 + 1) * th;
+    size_t scratch_len = fft2d_batch_scratch_len(FFT2D_R2C, tw, th, 3, 1);
+
+    fft_real *kernel = malloc(3 * K * sizeof(fft_real));
+    fft_real *tiles = calloc(3 * tile, sizeof(fft_real));
+    Complex *spectra = malloc(3 * half_len * sizeof(Complex));
+    Complex *scratch = scratch_len ? malloc(scratch_len * sizeof(Complex)) : NULL;
+    int status = -1;
+    if (!kernel || !tiles || !spectra || !scratch) {
+        perror("Erro ao alocar memoria para o kernel");
+        goto done;
+    }
+    for (int y = 0; y < kh; y++) {
+        bmp_decode_row(&img, y, kernel + y * kw, kernel + K + y * kw, kernel + 2 * K + y * kw);
+    }
+
+    double norm = 0;
+    for (int c = 0; c < 3; c++) {
+        fft_real *plane = kernel + c * K;
+        double sum = 0;
+        for (size_t i = 0; i < K; i++) {
+            sum += plane[i];
+        }
+        for (size_t i = 0; i < K; i++) {
+            if (mode == MATCH_CORRELATE) {
+                plane[i] -= sum / K; // modelo com média zero: o nível da imagem não pesa
+                norm += plane[i] * plane[i];
+            } else if (sum != 0) {
+                plane[i] /= sum; // kernel com ganho unitário por canal
+            }
+        }
+        // a convolução é a correlação com o kernel espelhado nos dois eixos
+        for (int y = 0; y < kh; y++) {
+            for (int x = 0; x < kw; x++) {
+                size_t at = mode == MATCH_CONVOLVE ? (size_t)(kh - 1 - y) * tw + (kw - 1 - x) : (size_t)y * tw + x;
+                tiles[c * tile + at] = plane[(size_t)y * kw + x];
+            }
+        }
+    }
+    if (mode == MATCH_CORRELATE && norm == 0) {
+        fprintf(stderr, "Modelo sem variacao: %s\n", filename);
+        goto done;
+    }
+
+    fft_real *tile_planes[3] = {tiles, tiles + tile, tiles + 2 * tile};
+    Complex *tile_spectra[3] = {spectra, spectra + half_len, spectra + 2 * half_len};
+    if (fft2d_batch(NULL, FFT2D_R2C, 3, tile_planes, tile_spectra, scratch, tw, th) != 0) {
+        goto done;
+    }
+    double scale = 1.0 / (double)tile;
+    for (size_t i = 0; i < 3 * half_len; i++) {
+        spectra[i].real *= scale;
+        spectra[i].imag *= -scale;
+    }
+
+    match_kernel.mode = mode;
+    match_kernel.width = kw;
+    match_kernel.height = kh;
+    match_kernel.tile_width = tw;
+    match_kernel.tile_height = th;
+    match_kernel.spectra = spectra;
+    match_kernel.source_hash = fnv1a(FNV_OFFSET, img.data, img.size);
+    match_kernel.norm = sqrt(norm);
+    spectra = NULL;
+    status = 0;
+
+done:
+    bmp_close(&img);
+    free(kernel);
+    free(tiles);
+    free(spectra);
+    free(scratch);
+    return status;
+}
+
+static PROGRAM_ONLY void match_kernel_free(void) {
+    free(match_kernel.spectra);
+    match_kernel.spectra = NULL;
+    match_kernel.mode = MATCH_NONE;
+}
+
+// Insere um candidato entre os picos; dois picos a menos de meio modelo de
+// distância um do outro são o mesmo, e fica o maior
+static void peak_insert(MatchPeak *peaks, int *count, int x, int y, double score) {
+    int radius_x = match_kernel.width / 2;
+    int radius_y = match_kernel.height / 2;
+    int lowest = 0;
+    for (int i = 0; i < *count; i++) {
+        if (abs(peaks[i].x - x) <= radius_x && abs(peaks[i].y - y) <= radius_y) {
+            if (score > peaks[i].score) {
+                peaks[i].x = x;
+                peaks[i].y = y;
+                peaks[i].score = score;
+            }
+            return;
+        }
+        if (peaks[i].score < peaks[lowest].score) {
+            lowest = i;
+        }
+    }
+    if (*count < match_kernel.peaks) {
+        lowest = (*count)++;
+    } else if (score <= peaks[lowest].score) {
+        return;
+    }
+    peaks[lowest].x = x;
+    peaks[lowest].y = y;
+    peaks[lowest].score = score;
+}
+
+static int compare_peaks(const void *a, const void *b) {
+    double sa = ((const MatchPeak *)a)->score;
+    double sb = ((const MatchPeak *)b)->score;
+    return (sa < sb) - (sa > sb);
+}
+
+// Convolui (output recebe os três planos, em fft_real) ou correlaciona
+// (peaks recebe os melhores casamentos) os planos de uma imagem com o kernel
+// carregado. Para a correlação, output guarda as somas acumuladas, em double,
+// que normalizam cada posição pela energia local da imagem.
+static int match_channels(Workspace *ws, fft_real **planes, int width, int height, void *output, MatchPeak *peaks,
+                   int *peak_count) {
+    int kw = match_kernel.width;
+    int kh = match_kernel.height;
+    int tw = match_kernel.tile_width;
+    int th = match_kernel.tile_height;
+    int correlate = match_kernel.mode == MATCH_CORRELATE;
+    size_t tile = (size_t)tw * th;
+    size_t half_len = (size_t)(tw / 2 + 1) * th;
+
+    // posições calculadas: só as com o modelo inteiro dentro da imagem, ou
+    // todas as da imagem com o kernel centrado
+    int x0 = correlate ? 0 : -(kw - 1 - kw / 2);
+    int y0 = correlate ? 0 : -(kh - 1 - kh / 2);
+    int out_w = correlate ? width - kw + 1 : width;
+    int out_h = correlate ? height - kh + 1 : height;
+    if (out_w < 1 || out_h < 1) {
+        fprintf(stderr, "Modelo (%dx%d) maior que a imagem (%dx%d)\n", kw, kh, width, height);
+        return -1;
+    }
+
+    ThreadPool *pool = workspace_pool(ws);
+    size_t scratch_len = fft2d_batch_scratch_len(FFT2D_R2C, tw, th, 3, pool_threads(pool));
+    fft_real *tiles = workspace_get(ws, WS_TILE, 3 * tile * sizeof(fft_real));
+    Complex *spectrum = workspace_get(ws, WS_TILE_SPECTRUM, 3 * half_len * sizeof(Complex));
+    Complex *scratch = scratch_len ? workspace_get(ws, WS_SCRATCH, scratch_len * sizeof(Complex)) : NULL;
+    if (!tiles || !spectrum || !scratch) {
+        perror("Erro ao alocar memoria para os blocos");
+        return -1;
+    }
+    fft_real *tile_planes[3] = {tiles, tiles + tile, tiles + 2 * tile};
+    Complex *tile_spectra[3] = {spectrum, spectrum + half_len, spectrum + 2 * half_len};
+
+    // somas acumuladas: de cada canal e dos quadrados de todos os canais
+    size_t stride = (size_t)width + 1;
+    size_t table = stride * (height + 1);
+    double *table_base = output;
+    double *sums[4] = {table_base, table_base + table, table_base + 2 * table, table_base + 3 * table};
+    fft_real *convolved = output;
+    if (correlate) {
+        for (int t = 0; t < 4; t++) {
+            memset(sums[t], 0, stride * sizeof(double));
+        }
+        for (int y = 0; y < height; y++) {
+            for (int t = 0; t < 4; t++) {
+                sums[t][(y + 1) * stride] = 0;
+            }
+            for (int x = 0; x < width; x++) {
+                size_t at = (y + 1) * stride + x + 1;
+                double squares = 0;
+                for (int c = 0; c < 3; c++) {
+                    double v = planes[c][(size_t)y * width + x];
+                    sums[c][at] = v + sums[c][at - 1] + sums[c][at - stride] - sums[c][at - stride - 1];
+                    squares += v * v;
+                }
+                sums[3][at] = squares + sums[3][at - 1] + sums[3][at - stride] - sums[3][at - stride - 1];
+            }
+        }
+        *peak_count = 0;
+    }
+
+    int step_x = tw - kw + 1;
+    int step_y = th - kh + 1;
+    double n = (double)kw * kh;
+    for (int ty = 0; ty < out_h; ty += step_y) {
+        for (int tx = 0; tx < out_w; tx += step_x) {
+            // bloco com origem em (x0 + tx, y0 + ty); fora da imagem vale zero
+            int ox = x0 + tx;
+            int oy = y0 + ty;
+            int first_x = ox < 0 ? -ox : 0;
+            int last_x = width - ox < tw ? width - ox : tw;
+            for (int c = 0; c < 3; c++) {
+                for (int r = 0; r < th; r++) {
+                    fft_real *row = tile_planes[c] + (size_t)r * tw;
+                    int y = oy + r;
+                    if (y < 0 || y >= height || first_x >= last_x) {
+                        memset(row, 0, tw * sizeof(fft_real));
+                        continue;
+                    }
+                    memset(row, 0, first_x * sizeof(fft_real));
+                    memcpy(row + first_x, planes[c] + (size_t)y * width + ox + first_x,
+                           (last_x - first_x) * sizeof(fft_real));
+                    memset(row + last_x, 0, (tw - last_x) * sizeof(fft_real));
+                }
+            }
+            if (fft2d_batch(pool, FFT2D_R2C, 3, tile_planes, tile_spectra, scratch, tw, th) != 0) {
+                return -1;
+            }
+
+            int count = correlate ? 1 : 3;
+            for (size_t i = 0; i < half_len; i++) {
+                Complex sum = {0, 0};
+                for (int c = 0; c < 3; c++) {
+                    Complex a = tile_spectra[c][i];
+                    Complex b = match_kernel.spectra[c * half_len + i];
+                    Complex product = {a.real * b.real - a.imag * b.imag, a.real * b.imag + a.imag * b.real};
+                    if (correlate) {
+                        // os canais são somados antes da inversa: uma só por bloco
+                        sum.real += product.real;
+                        sum.imag += product.imag;
+                    } else {
+                        tile_spectra[c][i] = product;
+                    }
+                }
+                if (correlate) {
+                    tile_spectra[0][i] = sum;
+                }
+            }
+            if (fft2d_batch(pool, FFT2D_C2R, count, tile_planes, tile_spectra, scratch, tw, th) != 0) {
+                return -1;
+            }
+
+            int valid_w = out_w - tx < step_x ? out_w - tx : step_x;
+            int valid_h = out_h - ty < step_y ? out_h - ty : step_y;
+            for (int j = 0; j < valid_h; j++) {
+                const fft_real *row = tile_planes[0] + (size_t)j * tw;
+                int y = ty + j;
+                if (!correlate) {
+                    for (int c = 0; c < 3; c++) {
+                        memcpy(convolved + c * (size_t)width * height + (size_t)y * width + tx,
+                               tile_planes[c] + (size_t)j * tw, valid_w * sizeof(fft_real));
+                    }
+                    continue;
+                }
+                for (int i = 0; i < valid_w; i++) {
+                    int x = tx + i;
+                    size_t a = (size_t)y * stride + x;
+                    size_t b = a + kw;
+                    size_t d = (size_t)(y + kh) * stride + x;
+                    size_t e = d + kw;
+                    double energy = sums[3][e] - sums[3][d] - sums[3][b] + sums[3][a];
+                    for (int c = 0; c < 3; c++) {
+                        double sum = sums[c][e] - sums[c][d] - sums[c][b] + sums[c][a];
+                        energy -= sum * sum / n;
+                    }
+                    double score = energy > 1e-9 ? row[i] / (sqrt(energy) * match_kernel.norm) : 0.0;
+                    // linhas do plano são de baixo para cima; o pico é dado de cima para baixo
+                    peak_insert(peaks, peak_count, x, height - kh - y, score);
+                }
+            }
+        }
+    }
+    if (correlate) {
+        qsort(peaks, *peak_count, sizeof(MatchPeak), compare_peaks);
+    }
+    return 0;
+}
+
+// Bytes de WS_OUTPUT usados por match_channels
+static size_t match_output_bytes(int width, int height) {
+    if (match_kernel.mode == MATCH_CORRELATE) {
+        return 4 * ((size_t)width + 1) * (height + 1) * sizeof(double);
+    }
+    return 3 * (size_t)width * height * sizeof(fft_real);
+}
+
+// Modo fora da memória: imagens cujo processamento não cabe em
+// options.memory_budget são transformadas em disco. Uma passada pelas linhas
+// grava o meio espectro de cada linha num arquivo temporário, organizado em
+// faixas verticais de colunas; cada faixa cabe no orçamento, é lida inteira,
+// tem as colunas transformadas e volta para o disco; por fim as linhas são
+// remontadas a partir das faixas e gravadas em sequência. O arquivo
+// temporário é acessado com leituras e escritas posicionadas em vez de
+// mapeado: páginas sujas de um mapeamento contariam na memória residente.
+// O orçamento vale para o processo inteiro: cada imagem na memória reserva
+// os seus bytes antes de ser lida e os devolve depois de gravada, e uma
+// imagem em disco reserva o orçamento todo.
+
+// Memória usada pelo processamento de uma imagem inteira na memória
+static size_t in_core_bytes(const BmpImage *img, int nthreads) {
+    size_t N = (size_t)img->width * img->height;
+    size_t half_len = (size_t)(img->width / 2 + 1) * img->height;
+    size_t bytes = img->size + 3 * N * sizeof(fft_real) + 3 * half_len * sizeof(Complex);
+    bytes += fft2d_batch_scratch_len(FFT2D_R2C, img->width, img->height, 3, nthreads) * sizeof(Complex);
+    if (options.pack_channels) {
+        bytes += N * sizeof(Complex);
+    }
+    if (options.full_spectrum) {
+        bytes += N * sizeof(Complex);
+    }
+    if (filter_count) {
+        bytes += half_len * sizeof(fft_real);
+    }
+    if (match_kernel.mode != MATCH_NONE) {
+        size_t tile = (size_t)match_kernel.tile_width * match_kernel.tile_height;
+        size_t tile_half = (size_t)(match_kernel.tile_width / 2 + 1) * match_kernel.tile_height;
+        bytes += match_output_bytes(img->width, img->height) + 3 * tile * sizeof(fft_real) +
+                 3 * tile_half * sizeof(Complex);
+    }
+    if (options.spectrum_bmp) {
+        bytes += N * sizeof(RGB) + 3 * half_len * sizeof(fft_real);
+    }
+    return bytes;
+}
+
+// Bytes do orçamento reservados pelas imagens em andamento. Uma reserva
+// espera até caber no que sobra; uma imagem que pede mais que o orçamento
+// (a imagem em disco pede ele todo) espera as outras terminarem e passa a
+// ser a única em andamento.
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t released;
+    size_t used;
+} memory_reserved = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0};
+
+static void memory_reserve(size_t bytes) {
+    pthread_mutex_lock(&memory_reserved.lock);
+    while (memory_reserved.used > 0 && memory_reserved.used + bytes > options.memory_budget) {
+        pthread_cond_wait(&memory_reserved.released, &memory_reserved.lock);
+    }
+    memory_reserved.used += bytes;
+    pthread_mutex_unlock(&memory_reserved.lock);
+}
+
+static void memory_release(size_t bytes) {
+    pthread_mutex_lock(&memory_reserved.lock);
+    memory_reserved.used -= bytes;
+    pthread_cond_broadcast(&memory_reserved.released);
+    pthread_mutex_unlock(&memory_reserved.lock);
+}
+
+// Meio espectro dos três canais no disco. Cada canal ocupa height x half
+// Complex, dividido em faixas de band_cols colunas guardadas uma após a
+// outra; dentro de uma faixa, as height linhas são contíguas
+typedef struct {
+    DiskFile file; // temporário
+    int width;
+    int height;
+    int half;      // colunas do meio espectro
+    int band_cols; // colunas por faixa (a última pode ser mais estreita)
+    int bands;
+} OutOfCore;
+
+static int ooc_band_cols(const OutOfCore *ooc, int band) {
+    int first = band * ooc->band_cols;
+    return ooc->half - first < ooc->band_cols ? ooc->half - first : ooc->band_cols;
+}
+
+static uint64_t ooc_offset(const OutOfCore *ooc, int channel, int band, int row) {
+    uint64_t first = (uint64_t)band * ooc->band_cols;
+    uint64_t index = ((uint64_t)channel * ooc->half + first) * ooc->height +
+                     (uint64_t)row * ooc_band_cols(ooc, band);
+    return index * sizeof(Complex);
+}
+
+// Move as linhas [first, first + count) de um canal entre rows (count x half)
+// e as faixas no disco, passando por block (count x band_cols)
+static int ooc_transfer_rows(OutOfCore *ooc, int channel, int first, int count,
+                             Complex *rows, Complex *block, int writing) {
+    for (int b = 0; b < ooc->bands; b++) {
+        int x0 = b * ooc->band_cols;
+        int cols = ooc_band_cols(ooc, b);
+        size_t bytes = (size_t)count * cols * sizeof(Complex);
+        uint64_t offset = ooc_offset(ooc, channel, b, first);
+        if (writing) {
+            for (int r = 0; r < count; r++) {
+                memcpy(block + (size_t)r * cols, rows + (size_t)r * ooc->half + x0, cols * sizeof(Complex));
+            }
+            if (disk_io(&ooc->file, block, bytes, offset, 1) != 0) {
+                return -1;
+            }
+        } else {
+            if (disk_io(&ooc->file, block, bytes, offset, 0) != 0) {
+                return -1;
+            }
+            for (int r = 0; r < count; r++) {
+                memcpy(rows + (size_t)r * ooc->half + x0, block + (size_t)r * cols, cols * sizeof(Complex));
+            }
+        }
+    }
+    return 0;
+}
+
+// Passada pelas linhas: decodifica block_rows linhas do BMP por vez, grava as
+// prévias, transforma cada linha de cada canal e guarda os meios espectros
+static int ooc_row_pass(OutOfCore *ooc, const BmpImage *img, const FFTPlan *plan, size_t work_len,
+                        int block_rows, FILE **previews) {
+    int width = ooc->width;
+    size_t plane_len = (size_t)block_rows * width;
+    size_t rows_len = (size_t)block_rows * ooc->half;
+    size_t samples_bytes = 3 * plane_len * sizeof(fft_real);
+    size_t rows_bytes = 3 * rows_len * sizeof(Complex);
+    size_t block_bytes = (size_t)block_rows * ooc->band_cols * sizeof(Complex);
+    size_t work_bytes = work_len * sizeof(Complex);
+    fft_real *samples = pages_alloc(samples_bytes);
+    Complex *rows = pages_alloc(rows_bytes);
+    Complex *block = pages_alloc(block_bytes);
+    Complex *work = pages_alloc(work_bytes);
+    int status = -1;
+    if (!samples || !rows || !block || !work) {
+        perror("Erro ao alocar memoria para a FFT");
+        goto done;
+    }
+
+    for (int y0 = 0; y0 < ooc->height; y0 += block_rows) {
+        int count = ooc->height - y0 < block_rows ? ooc->height - y0 : block_rows;
+        for (int r = 0; r < count; r++) {
+            fft_real *red = samples + CHANNEL_RED * plane_len + (size_t)r * width;
+            fft_real *green = samples + CHANNEL_GREEN * plane_len + (size_t)r * width;
+            fft_real *blue = samples + CHANNEL_BLUE * plane_len + (size_t)r * width;
+            bmp_decode_row(img, y0 + r, red, green, blue);
+            for (int c = 0; c < 3; c++) {
+                if (previews[c]) {
+                    write_channel_row(previews[c], samples + c * plane_len + (size_t)r * width, c, width);
+                }
+            }
+        }
+        bmp_release_rows(img, y0, y0 + count);
+
+        for (int c = 0; c < 3; c++) {
+            for (int r = 0; r < count; r++) {
+                fft_execute_r2c(plan, samples + c * plane_len + (size_t)r * width,
+                                rows + c * rows_len + (size_t)r * ooc->half, work);
+            }
+            if (ooc_transfer_rows(ooc, c, y0, count, rows + c * rows_len, block, 1) != 0) {
+                perror("Erro ao gravar arquivo temporario");
+                goto done;
+            }
+        }
+    }
+    status = 0;
+
+done:
+    pages_free(samples, samples_bytes);
+    pages_free(rows, rows_bytes);
+    pages_free(block, block_bytes);
+    pages_free(work, work_bytes);
+    return status;
+}
+
+// Passada pelas colunas: cada faixa é lida inteira, tem as colunas
+// transformadas e é regravada no mesmo lugar
+static int ooc_column_pass(OutOfCore *ooc, const FFTPlan *plan, size_t work_len) {
+    int height = ooc->height;
+    size_t band_bytes = (size_t)height * ooc->band_cols * sizeof(Complex);
+    size_t column_bytes = (size_t)height * sizeof(Complex);
+    size_t work_bytes = work_len * sizeof(Complex);
+    Complex *band = pages_alloc(band_bytes);
+    Complex *column = pages_alloc(column_bytes);
+    Complex *work = pages_alloc(work_bytes);
+    int status = -1;
+    if (!band || !column || !work) {
+        perror("Erro ao alocar memoria para a FFT");
+        goto done;
+    }
+
+    for (int c = 0; c < 3; c++) {
+        for (int b = 0; b < ooc->bands; b++) {
+            int cols = ooc_band_cols(ooc, b);
+            size_t bytes = (size_t)height * cols * sizeof(Complex);
+            uint64_t offset = ooc_offset(ooc, c, b, 0);
+            if (disk_io(&ooc->file, band, bytes, offset, 0) != 0) {
+                perror("Erro ao ler arquivo temporario");
+                goto done;
+            }
+            for (int x = 0; x < cols; x++) {
+                for (int y = 0; y < height; y++) {
+                    column[y] = band[(size_t)y * cols + x];
+                }
+                fft_execute(plan, column, work);
+                for (int y = 0; y < height; y++) {
+                    band[(size_t)y * cols + x] = column[y];
+                }
+            }
+            if (disk_io(&ooc->file, band, bytes, offset, 1) != 0) {
+                perror("Erro ao gravar arquivo temporario");
+                goto done;
+            }
+        }
+    }
+    status = 0;
+
+done:
+    pages_free(band, band_bytes);
+    pages_free(column, column_bytes);
+    pages_free(work, work_bytes);
+    return status;
+}
+
+// Remonta as linhas de um canal a partir das faixas e grava o espectro em
+// sequência; o espectro completo busca cada linha espelhada no disco
+static int ooc_save_spectrum(OutOfCore *ooc, int channel, int block_rows, const SpectrumOutput *output) {
+    int half = ooc->half;
+    int full_spectrum = output->settings->full_spectrum;
+    size_t rows_bytes = (size_t)block_rows * half * sizeof(Complex);
+    size_t block_bytes = (size_t)block_rows * ooc->band_cols * sizeof(Complex);
+    Complex *rows = pages_alloc(rows_bytes);
+    Complex *block = pages_alloc(block_bytes);
+    Complex *mirror = NULL;
+    Complex *full = NULL;
+    if (full_spectrum) {
+        mirror = malloc(half * sizeof(Complex));
+        full = malloc(ooc->width * sizeof(Complex));
+    }
+    int status = -1;
+    if (!rows || !block || (full_spectrum && (!mirror || !full))) {
+        perror("Erro ao alocar memoria para o espectro");
+        pages_free(rows, rows_bytes);
+        pages_free(block, block_bytes);
+        free(mirror);
+        free(full);
+        return -1;
+    }
+
+    SpectrumWriter writer;
+    spectrum_writer_open(&writer, output, ooc->width, ooc->height);
+    for (int y0 = 0; y0 < ooc->height; y0 += block_rows) {
+        int count = ooc->height - y0 < block_rows ? ooc->height - y0 : block_rows;
+        if (ooc_transfer_rows(ooc, channel, y0, count, rows, block, 0) != 0) {
+            perror("Erro ao ler arquivo temporario");
+            goto done;
+        }
+        if (!full_spectrum) {
+            spectrum_writer_write(&writer, rows, (size_t)count * half);
+            continue;
+        }
+        for (int r = 0; r < count; r++) {
+            int m = (ooc->height - (y0 + r)) % ooc->height;
+            const Complex *mirror_row = rows + (size_t)(m - y0) * half;
+            if (m < y0 || m >= y0 + count) {
+                if (ooc_transfer_rows(ooc, channel, m, 1, mirror, block, 0) != 0) {
+                    perror("Erro ao ler arquivo temporario");
+                    goto done;
+                }
+                mirror_row = mirror;
+            }
+            expand_spectrum_row(rows + (size_t)r * half, mirror_row, full, ooc->width);
+            spectrum_writer_write(&writer, full, ooc->width);
+        }
+    }
+    status = 0;
+
+done:
+    spectrum_writer_close(&writer);
+    pages_free(rows, rows_bytes);
+    pages_free(block, block_bytes);
+    free(mirror);
+    free(full);
+    return status;
+}
+
+// Transforma os três canais de img em disco, com no máximo
+// options.memory_budget bytes de buffers na memória
+static int apply_fft_out_of_core(const BmpImage *img, int image_index, const char *const *preview_filenames,
+                          const SpectrumOutput *outputs) {
+    int width = img->width;
+    int height = img->height;
+    int half = width / 2 + 1;
+    FFTPlan *row_plan = get_real_fft_plan(width);
+    FFTPlan *column_plan = get_fft_plan(height);
+    if (!row_plan || !column_plan) {
+        return -1;
+    }
+    size_t work_len = max_size(row_plan->work_len, column_plan->work_len);
+    size_t budget = options.memory_budget;
+
+    // passada pelas colunas: uma faixa, a coluna em transformação e o trabalho da FFT
+    size_t column_bytes = (size_t)height * sizeof(Complex);
+    size_t column_fixed = column_bytes + work_len * sizeof(Complex);
+    // passadas pelas linhas, por linha: amostras e meios espectros dos três
+    // canais, a linha mapeada do BMP e sua parte no bloco de uma faixa
+    size_t row_bytes = 3 * (size_t)width * sizeof(fft_real) + img->stride + (3 * (size_t)half + half) * sizeof(Complex);
+    size_t row_fixed = work_len * sizeof(Complex);
+    if (options.full_spectrum) {
+        row_fixed += (size_t)(width + half) * sizeof(Complex);
+    }
+    size_t minimum = max_size(column_fixed + column_bytes, row_fixed + row_bytes);
+    if (budget < minimum) {
+        fprintf(stderr, "Orcamento de memoria insuficiente para %dx%d: minimo de %zu MB\n",
+                width, height, (minimum >> 20) + 1);
+        return -1;
+    }
+
+    OutOfCore ooc;
+    ooc.width = width;
+    ooc.height = height;
+    ooc.half = half;
+    size_t band_cols = (budget - column_fixed) / column_bytes;
+    ooc.band_cols = band_cols < (size_t)half ? (int)band_cols : half;
+    ooc.bands = (half + ooc.band_cols - 1) / ooc.band_cols;
+    size_t block_rows = (budget - row_fixed) / row_bytes;
+    if (block_rows > (size_t)height) {
+        block_rows = height;
+    }
+
+    char scratch_name[MAX_FILENAME_LENGTH];
+    if (snprintf(scratch_name, sizeof(scratch_name), "%s/imgfourier_%02d", options.scratch_dir, image_index) >=
+        (int)sizeof(scratch_name)) {
+        fprintf(stderr, "Caminho de --scratch-dir muito longo: %s\n", options.scratch_dir);
+        return -1;
+    }
+    if (disk_open_temporary(&ooc.file, scratch_name) != 0) {
+        perror("Erro ao criar arquivo temporario");
+        return -1;
+    }
+
+    FILE *previews[3] = {NULL, NULL, NULL};
+    if (preview_filenames) {
+        for (int c = 0; c < 3; c++) {
+            previews[c] = open_channel_bmp(preview_filenames[c], width, height);
+        }
+    }
+    int status = ooc_row_pass(&ooc, img, row_plan, work_len, (int)block_rows, previews);
+    for (int c = 0; c < 3; c++) {
+        if (previews[c]) {
+            fclose(previews[c]);
+        }
+    }
+
+    if (status == 0) {
+        status = ooc_column_pass(&ooc, column_plan, work_len);
+    }
+    for (int c = 0; c < 3 && status == 0; c++) {
+        status = ooc_save_spectrum(&ooc, c, (int)block_rows, &outputs[c]);
+    }
+
+    disk_close(&ooc.file);
+    return status;
+}
+
+// Uma imagem em processamento. Passa do estágio de leitura para o de
+// cálculo e deste para o de escrita; os buffers (WS_INPUT e WS_SPECTRUM de
+// buffers) continuam com o job e são reaproveitados pela próxima imagem.
+typedef struct {
+    const char *input_file;
+    int image_index;
+    int width;
+    int height;
+    int status;         // JOB_*
+    BmpImage img;       // mantido aberto só para o modo fora da memória
+    fft_real *channels[3];
+    Complex *spectra[3];
+    Workspace *buffers;
+    char preview_names[3][MAX_FILENAME_LENGTH];
+    char dat_names[3][MAX_FILENAME_LENGTH];
+    char txt_names[3][MAX_FILENAME_LENGTH];
+    char filtered_name[MAX_FILENAME_LENGTH];
+    char convolved_name[MAX_FILENAME_LENGTH];
+    char spectrum_name[MAX_FILENAME_LENGTH];
+    SpectrumSettings settings;
+    SpectrumOutput outputs[3];
+    ImageMetrics metrics;
+    void *output;       // resultado de match_channels (WS_OUTPUT de buffers)
+    MatchPeak peaks[MAX_PEAKS];
+    int peak_count;
+    size_t reserved;    // bytes do orçamento de memória, devolvidos por write_image
+} ImageJob;
+
+enum {
+    JOB_FAILED,      // nada mais a fazer
+    JOB_DECODED,     // canais separados, à espera da FFT
+    JOB_OUT_OF_CORE, // BMP aberto, será transformado em disco
+    JOB_TRANSFORMED, // espectros prontos para gravar
+    JOB_DONE         // já gravada (modo fora da memória)
+};
+
+static void image_job_names(ImageJob *job) {
+    static const char *const preview_formats[3] = {
+        "output_channels/red_channel_%02d.bmp",
+        "output_channels/green_channel_%02d.bmp",
+        "output_channels/blue_channel_%02d.bmp"
+    };
+    static const char *const dat_formats[3] = {
+        "output_fft_DAT/red_channel_fft_%02d.dat",
+        "output_fft_DAT/green_channel _fft_%02d.dat",
+        "output_fft_DAT/blue_channel_fft_%02d.dat"
+    };
+    static const char *const txt_formats[3] = {
+        "output_fft_TXT/red_channel_fft_%02d.txt",
+        "output_fft_TXT/green_channel_fft_%02d.txt",
+        "output_fft_TXT/blue_channel_fft_%02d.txt"
+    };
+    job->settings = program_spectrum_settings();
+    for (int c = 0; c < 3; c++) {
+        snprintf(job->preview_names[c], MAX_FILENAME_LENGTH, preview_formats[c], job->image_index);
+        snprintf(job->dat_names[c], MAX_FILENAME_LENGTH, dat_formats[c], job->image_index);
+        snprintf(job->txt_names[c], MAX_FILENAME_LENGTH, txt_formats[c], job->image_index);
+        job->outputs[c].channel = c;
+        job->outputs[c].image_index = job->image_index;
+        job->outputs[c].source = job->input_file;
+        job->outputs[c].dat_filename = job->dat_names[c];
+        job->outputs[c].txt_filename = job->txt_names[c];
+        job->outputs[c].metrics = &job->metrics;
+        job->outputs[c].settings = &job->settings;
+    }
+    snprintf(job->filtered_name, MAX_FILENAME_LENGTH, "output_filtered/filtered_%02d.bmp", job->image_index);
+    snprintf(job->convolved_name, MAX_FILENAME_LENGTH, "output_convolved/convolved_%02d.bmp", job->image_index);
+    snprintf(job->spectrum_name, MAX_FILENAME_LENGTH, "output_spectrum/spectrum_%02d.bmp", job->image_index);
+}
+
+// Estágio de leitura: abre o BMP e separa os canais numa única passada,
+// direto nos planos de entrada da FFT. image_index numera os arquivos de
+// saída e é atribuído antes do processamento, de modo que os nomes não
+// dependem da ordem de término.
+static int load_image(ImageJob *job, const char *input_file, int image_index) {
+    job->input_file = input_file;
+    job->image_index = image_index;
+    job->status = JOB_FAILED;
+    job->reserved = 0;
+    image_job_names(job);
+    memset(&job->metrics, 0, sizeof(job->metrics));
+
+    double start = metrics_clock();
+    if (bmp_open(input_file, &job->img) != 0) {
+        return -1;
+    }
+    job->width = job->img.width;
+    job->height = job->img.height;
+    job->metrics.bytes_read = job->img.size;
+    metrics_add(&job->metrics, STAGE_READ, start);
+
+    size_t bytes = options.memory_budget ? in_core_bytes(&job->img, options.threads) : 0;
+    if (bytes > options.memory_budget) {
+        if (filter_count || match_kernel.mode != MATCH_NONE || options.spectrum_bmp) {
+            fprintf(stderr, "Filtro, convolucao, correlacao e imagem do espectro nao suportados no modo fora da "
+                    "memoria: %s\n", input_file);
+            bmp_close(&job->img);
+            return -1;
+        }
+        // não cabe no orçamento: fica para o estágio de cálculo, que lê em
+        // faixas, depois que as imagens anteriores forem gravadas
+        job->reserved = options.memory_budget;
+        memory_reserve(job->reserved);
+        job->status = JOB_OUT_OF_CORE;
+        return 0;
+    }
+    if (bytes) {
+        job->reserved = bytes;
+        memory_reserve(bytes);
+    }
+
+    start = metrics_clock();
+    size_t N = (size_t)job->width * job->height;
+    unsigned allocations = job->buffers->allocations;
+    fft_real *planes = workspace_get(job->buffers, WS_INPUT, 3 * N * sizeof(fft_real));
+    job->metrics.allocations += job->buffers->allocations - allocations;
+    if (!planes) {
+        perror("Erro ao alocar memoria para os canais.");
+        bmp_close(&job->img);
+        memory_release(job->reserved);
+        job->reserved = 0;
+        return -1;
+    }
+    for (int c = 0; c < 3; c++) {
+        job->channels[c] = planes + c * N;
+    }
+
+    printf("Extraindo canais de cores do arquivo: %s\n", input_file);
+    for (int y = 0; y < job->height; y++) {
+        size_t offset = (size_t)y * job->width;
+        bmp_decode_row(&job->img, y, job->channels[CHANNEL_RED] + offset, job->channels[CHANNEL_GREEN] + offset,
+                       job->channels[CHANNEL_BLUE] + offset);
+    }
+    bmp_close(&job->img);
+    metrics_add(&job->metrics, STAGE_SPLIT, start);
+    job->status = JOB_DECODED;
+    return 0;
+}
+
+// Estágio de cálculo: ws é o workspace da thread (scratch e pool da FFT)
+static void transform_image(ImageJob *job, Workspace *ws) {
+    double start = metrics_clock();
+    if (job->status == JOB_OUT_OF_CORE) {
+        // leitura, FFT e gravação acontecem juntas, em faixas; o tempo de
+        // gravação do .dat e do .txt é descontado da FFT
+        printf("Processando em disco (%dx%d) o arquivo: %s\n", job->width, job->height, job->input_file);
+        const char *preview_filenames[3] = {job->preview_names[0], job->preview_names[1], job->preview_names[2]};
+        double writing = job->metrics.seconds[STAGE_DAT] + job->metrics.seconds[STAGE_TXT];
+        int status = apply_fft_out_of_core(&job->img, job->image_index,
+                                           options.channel_bmps ? preview_filenames : NULL, job->outputs);
+        bmp_close(&job->img);
+        memory_release(job->reserved);
+        job->reserved = 0;
+        metrics_add(&job->metrics, STAGE_FFT, start);
+        job->metrics.seconds[STAGE_FFT] -= job->metrics.seconds[STAGE_DAT] + job->metrics.seconds[STAGE_TXT] - writing;
+        job->status = status == 0 ? JOB_DONE : JOB_FAILED;
+        return;
+    }
+    if (job->status != JOB_DECODED) {
+        return;
+    }
+
+    if (match_kernel.mode != MATCH_NONE) {
+        // convolução e correlação trabalham em blocos, sem o espectro inteiro
+        unsigned allocations = job->buffers->allocations + ws->allocations;
+        job->output = workspace_get(job->buffers, WS_OUTPUT, match_output_bytes(job->width, job->height));
+        int ok = job->output && match_channels(ws, job->channels, job->width, job->height, job->output, job->peaks,
+                                               &job->peak_count) == 0;
+        if (!job->output) {
+            perror("Erro ao alocar memoria para o resultado");
+        }
+        job->metrics.allocations += job->buffers->allocations + ws->allocations - allocations;
+        metrics_add(&job->metrics, STAGE_FFT, start);
+        job->status = ok ? JOB_TRANSFORMED : JOB_FAILED;
+        return;
+    }
+
+    size_t half_len = (size_t)(job->width / 2 + 1) * job->height;
+    unsigned allocations = job->buffers->allocations + ws->allocations;
+    Complex *spectra = workspace_get(job->buffers, WS_SPECTRUM, 3 * half_len * sizeof(Complex));
+    if (!spectra) {
+        perror("Erro ao alocar memoria para a FFT");
+        job->status = JOB_FAILED;
+        return;
+    }
+    for (int c = 0; c < 3; c++) {
+        job->spectra[c] = spectra + c * half_len;
+    }
+    wisdom_tune(ws, job->channels, job->spectra, job->width, job->height);
+    int ok = transform_channels(ws, job->channels, job->spectra, job->width, job->height) == 0;
+    if (ok && filter_count) {
+        // filtro e inversa logo em seguida, com o espectro ainda na memória
+        ok = filter_channels(ws, job->spectra, job->channels, job->width, job->height) == 0;
+    }
+    job->metrics.allocations += job->buffers->allocations + ws->allocations - allocations;
+    metrics_add(&job->metrics, STAGE_FFT, start);
+    job->status = ok ? JOB_TRANSFORMED : JOB_FAILED;
+}
+
+// Manifesto (--manifest ARQUIVO): de cada entrada já processada, o hash
+// FNV-1a do conteúdo, o tamanho, a data de modificação e o índice nas saídas,
+// e um hash das opções que mudam as saídas. Uma imagem com o mesmo conteúdo e
+// as mesmas opções, cujas saídas ainda existem, é pulada. O conteúdo só é
+// lido para o hash quando o tamanho ou a data mudam.
+// Cada nome guarda o seu índice entre execuções: uma imagem nova recebe o
+// menor índice livre em vez de deslocar as que vêm depois dela na ordem
+// alfabética, e as saídas de uma imagem que saiu do diretório são apagadas.
+#define MANIFEST_VERSION 1
+#define MANIFEST_CHUNK (1 << 20) // bytes lidos por vez no hash de um arquivo
+
+typedef struct {
+    char name[MAX_FILENAME_LENGTH]; // vazio: não gravar
+    int image_index;
+    uint64_t size;
+    int64_t mtime; // nanossegundos
+    uint64_t hash;
+    int done;      // saídas em dia, desta execução ou de uma anterior
+    int present;   // ainda no diretório (entradas lidas do arquivo)
+} ManifestEntry;
+
+static struct {
+    uint64_t settings;       // hash das opções que mudam as saídas
+    int reusable;            // as saídas anteriores valem para as opções atuais
+    ManifestEntry *previous; // lidas do arquivo
+    int previous_count;
+    ManifestEntry *current;  // posição image_index - 1: a imagem com esse índice (nome vazio = nenhuma)
+    int current_count;
+} manifest = {0, 0, NULL, 0, NULL, 0};
+
+static uint64_t manifest_settings(void) {
+    char text[MAX_FILENAME_LENGTH + 64];
+    snprintf(text, sizeof(text), "%s %d %d %d %d %d %d %d %s", FFT_PRECISION_NAME, options.full_spectrum,
+             options.pack_channels, options.channel_bmps, options.txt_precision, options.dat_format,
+             match_kernel.mode, options.spectrum_bmp, options.archive_path ? options.archive_path : "");
+    uint64_t hash = fnv1a(FNV_OFFSET, text, strlen(text));
+    for (int i = 0; i < filter_count; i++) {
+        double params[3] = {filters[i].a, filters[i].b, filters[i].c};
+        hash = fnv1a(hash, &filters[i].type, sizeof(filters[i].type));
+        hash = fnv1a(hash, params, sizeof(params));
+    }
+    if (match_kernel.mode != MATCH_NONE) {
+        hash = fnv1a(hash, &match_kernel.source_hash, sizeof(match_kernel.source_hash));
+    }
+    return hash;
+}
+
+static int file_stamp(const char *filename, uint64_t *size, int64_t *mtime) {
+    struct stat st;
+    if (stat(filename, &st) != 0) {
+        return -1;
+    }
+    *size = (uint64_t)st.st_size;
+#ifndef _WIN32
+    *mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#else
+    *mtime = (int64_t)st.st_mtime * 1000000000;
+#endif
+    return 0;
+}
+
+static int hash_file(const char *filename, uint64_t *hash) {
+    FILE *fp = fopen(filename, "rb");
+    uint8_t *buffer = malloc(MANIFEST_CHUNK);
+    int status = -1;
+    if (fp && buffer) {
+        size_t bytes;
+        *hash = FNV_OFFSET;
+        while ((bytes = fread(buffer, 1, MANIFEST_CHUNK, fp)) > 0) {
+            *hash = fnv1a(*hash, buffer, bytes);
+        }
+        status = ferror(fp) ? -1 : 0;
+    }
+    if (fp) {
+        fclose(fp);
+    }
+    free(buffer);
+    return status;
+}
+
+static int file_exists(const char *filename) {
+    struct stat st;
+    return stat(filename, &st) == 0;
+}
+
+// As saídas da imagem image_index no modo atual estão todas presentes?
+static int outputs_exist(const char *input_file, int image_index) {
+    ImageJob job;
+    job.input_file = input_file;
+    job.image_index = image_index;
+    image_job_names(&job);
+    if (filter_count) {
+        return file_exists(job.filtered_name);
+    }
+    if (match_kernel.mode == MATCH_CONVOLVE) {
+        return file_exists(job.convolved_name);
+    }
+    if (options.spectrum_bmp) {
+        return file_exists(job.spectrum_name);
+    }
+    for (int c = 0; c < 3; c++) {
+        uint64_t offset, bytes;
+        if (options.archive_path ? archive_find(image_index, c, &offset, &bytes) != 0
+                                 : !file_exists(job.dat_names[c]) || !file_exists(job.txt_names[c]) ||
+                                       (options.channel_bmps && !file_exists(job.preview_names[c]))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Apaga as saídas que a imagem image_index pode ter deixado, em qualquer
+// modo; retorna quantos arquivos ou registros foram removidos
+static int remove_outputs(int image_index) {
+    ImageJob job;
+    job.input_file = NULL;
+    job.image_index = image_index;
+    image_job_names(&job);
+    int removed = (remove(job.filtered_name) == 0) + (remove(job.convolved_name) == 0) +
+                  (remove(job.spectrum_name) == 0);
+    for (int c = 0; c < 3; c++) {
+        removed += (remove(job.preview_names[c]) == 0) + (remove(job.dat_names[c]) == 0) +
+                   (remove(job.txt_names[c]) == 0);
+        uint64_t offset, bytes;
+        if (archive && archive_find(image_index, c, &offset, &bytes) == 0 && archive_remove(image_index, c) == 0) {
+            removed++;
+        }
+    }
+    return removed;
+}
+
+// Lê o manifesto de uma execução anterior. O arquivo tem a linha
+// "imgfourier-manifest VERSAO OPCOES" e uma linha "HASH TAMANHO DATA INDICE
+// NOME" por imagem; com opções diferentes as entradas só servem para manter
+// os índices e achar as imagens removidas.
+static PROGRAM_ONLY int manifest_load(const char *filename) {
+    manifest.settings = manifest_settings();
+    FILE *fp = fopen(filename, "r");
+    if (!fp) {
+        if (errno == ENOENT) {
+            return 0; // primeira execução: o manifesto é criado no fim
+        }
+        perror("Erro ao abrir o manifesto");
+        return -1;
+    }
+    char line[MAX_FILENAME_LENGTH + 96];
+    int version;
+    unsigned long long settings;
+    if (!fgets(line, sizeof(line), fp) || sscanf(line, "imgfourier-manifest %d %llx", &version, &settings) != 2 ||
+        version != MANIFEST_VERSION) {
+        fprintf(stderr, "Manifesto invalido, todas as imagens serao processadas: %s\n", filename);
+        fclose(fp);
+        return 0;
+    }
+    manifest.reusable = settings == manifest.settings;
+    if (!manifest.reusable) {
+        printf("Opcoes diferentes das do manifesto: todas as imagens serao processadas\n");
+    }
+
+    int capacity = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        unsigned long long hash, size;
+        long long mtime;
+        int image_index, name_start;
+        line[strcspn(line, "\n")] = '\0';
+        if (sscanf(line, "%llx %llu %lld %d %n", &hash, &size, &mtime, &image_index, &name_start) != 4 ||
+            image_index < 1 || line[name_start] == '\0') {
+            continue;
+        }
+        if (manifest.previous_count == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            ManifestEntry *entries = realloc(manifest.previous, capacity * sizeof(ManifestEntry));
+            if (!entries) {
+                perror("Erro ao alocar o manifesto");
+                break;
+            }
+            manifest.previous = entries;
+        }
+        ManifestEntry *entry = &manifest.previous[manifest.previous_count++];
+        snprintf(entry->name, sizeof(entry->name), "%s", line + name_start);
+        entry->image_index = image_index;
+        entry->size = size;
+        entry->mtime = mtime;
+        entry->hash = hash;
+        entry->done = 1;
+        entry->present = 0;
+    }
+    fclose(fp);
+    return 0;
+}
+
+static ManifestEntry *manifest_find(const char *name) {
+    for (int i = 0; i < manifest.previous_count; i++) {
+        if (strcmp(manifest.previous[i].name, name) == 0) {
+            return &manifest.previous[i];
+        }
+    }
+    return NULL;
+}
+
+// Dá a cada uma das count imagens do diretório o seu índice nas saídas,
+// indices[i], e decide se ela pode ser pulada, marcando unchanged[i]
+static void manifest_plan(char **files, int count, char *unchanged, int *indices) {
+    int highest = 0;
+    for (int i = 0; i < manifest.previous_count; i++) {
+        if (manifest.previous[i].image_index > highest) {
+            highest = manifest.previous[i].image_index;
+        }
+    }
+    int limit = highest + count; // nenhum índice passa disto
+    // owner[k]: 0 = índice k livre, 1 = de uma imagem do manifesto, 2 = de uma nova
+    char *owner = calloc(limit + 1, 1);
+    manifest.current = calloc(limit, sizeof(ManifestEntry));
+    if (!owner || !manifest.current) {
+        perror("Erro ao alocar o manifesto");
+        free(owner);
+        free(manifest.current);
+        manifest.current = NULL;
+        for (int i = 0; i < count; i++) {
+            indices[i] = i + 1;
+        }
+        return;
+    }
+    manifest.current_count = limit;
+
+    for (int i = 0; i < count; i++) {
+        ManifestEntry *old = manifest_find(files[i]);
+        indices[i] = 0;
+        if (old && !owner[old->image_index]) {
+            indices[i] = old->image_index;
+            owner[old->image_index] = 1;
+            old->present = 1;
+        }
+    }
+    int next = 1;
+    for (int i = 0; i < count; i++) {
+        if (!indices[i]) {
+            while (owner[next]) {
+                next++;
+            }
+            indices[i] = next;
+            owner[next] = 2;
+        }
+    }
+
+    // imagens que saíram do diretório: as saídas delas ficariam para trás
+    int removed = 0;
+    for (int i = 0; i < manifest.previous_count; i++) {
+        const ManifestEntry *old = &manifest.previous[i];
+        if (!old->present && owner[old->image_index] != 1 && remove_outputs(old->image_index) > 0) {
+            removed++;
+        }
+    }
+    free(owner);
+    if (removed) {
+        printf("Manifesto: removidas as saidas de %d imagens que sairam do diretorio\n", removed);
+    }
+
+    int skipped = 0;
+    for (int i = 0; i < count; i++) {
+        ManifestEntry *entry = &manifest.current[indices[i] - 1];
+        entry->image_index = indices[i];
+        if (file_stamp(files[i], &entry->size, &entry->mtime) != 0) {
+            continue;
+        }
+        const ManifestEntry *old = manifest_find(files[i]);
+        if (old && old->size == entry->size && old->mtime == entry->mtime) {
+            entry->hash = old->hash;
+        } else if (hash_file(files[i], &entry->hash) != 0) {
+            continue;
+        }
+        snprintf(entry->name, sizeof(entry->name), "%s", files[i]);
+        if (manifest.reusable && old && old->hash == entry->hash && old->image_index == entry->image_index &&
+            outputs_exist(files[i], entry->image_index)) {
+            unchanged[i] = 1;
+            entry->done = 1;
+            skipped++;
+        }
+    }
+    printf("Manifesto: %d de %d imagens sem mudancas\n", skipped, count);
+}
+
+// Chamada pela escrita quando as saídas de image_index estão gravadas
+static void manifest_record(int image_index) {
+    if (image_index >= 1 && image_index <= manifest.current_count) {
+        manifest.current[image_index - 1].done = 1;
+    }
+}
+
+// Grava as imagens com saídas em dia; as que falharam ou saíram do
+// diretório ficam de fora e voltam a ser processadas
+static int manifest_save(const char *filename) {
+    char *temporary;
+    FILE *fp = replace_open(filename, &temporary);
+    int status = 0;
+    if (!fp) {
+        perror("Erro ao gravar o manifesto");
+        status = -1;
+    } else {
+        fprintf(fp, "imgfourier-manifest %d %016llx\n", MANIFEST_VERSION, (unsigned long long)manifest.settings);
+        for (int i = 0; i < manifest.current_count; i++) {
+            const ManifestEntry *entry = &manifest.current[i];
+            if (entry->done && entry->name[0]) {
+                fprintf(fp, "%016llx %llu %lld %d %s\n", (unsigned long long)entry->hash,
+                        (unsigned long long)entry->size, (long long)entry->mtime, entry->image_index, entry->name);
+            }
+        }
+        if (replace_commit(fp, filename, temporary) != 0) {
+            perror("Erro ao gravar o manifesto");
+            status = -1;
+        }
+    }
+    free(manifest.previous);
+    free(manifest.current);
+    manifest.previous = manifest.current = NULL;
+    manifest.previous_count = manifest.current_count = 0;
+    manifest.reusable = 0;
+    return status;
+}
+
+// Estágio de escrita: prévias dos canais e espectros, ou só a imagem
+// filtrada; as medições da imagem entram no total do lote
+static void write_image(ImageJob *job, Workspace *ws) {
+    if (job->status == JOB_TRANSFORMED && match_kernel.mode == MATCH_CORRELATE) {
+        // um único printf por imagem, para as linhas de threads diferentes não se misturarem
+        char report[MAX_PEAKS * 96 + MAX_FILENAME_LENGTH + 64];
+        int length = snprintf(report, sizeof(report), "Picos de correlacao do arquivo: %s\n", job->input_file);
+        for (int i = 0; i < job->peak_count; i++) {
+            length += snprintf(report + length, sizeof(report) - length, "  %d: x=%d y=%d score=%.6f\n", i + 1,
+                               job->peaks[i].x, job->peaks[i].y, job->peaks[i].score);
+        }
+        fputs(report, stdout);
+        job->status = JOB_DONE;
+    }
+    if (job->status == JOB_TRANSFORMED && match_kernel.mode == MATCH_CONVOLVE) {
+        double start = metrics_clock();
+        size_t N = (size_t)job->width * job->height;
+        fft_real *convolved = job->output;
+        fft_real *planes[3] = {convolved, convolved + N, convolved + 2 * N};
+        printf("Gerando .bmp convolvido do arquivo: %s\n", job->input_file);
+        write_rgb_planes_bmp(job->convolved_name, planes, job->width, job->height);
+        job->metrics.bytes_written +=
+            sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER) + bmp_stride(job->width, 24) * job->height;
+        metrics_add(&job->metrics, STAGE_PREVIEW, start);
+        job->status = JOB_DONE;
+    }
+    if (job->status == JOB_TRANSFORMED && filter_count) {
+        double start = metrics_clock();
+        printf("Gerando .bmp filtrado do arquivo: %s\n", job->input_file);
+        write_rgb_planes_bmp(job->filtered_name, job->channels, job->width, job->height);
+        job->metrics.bytes_written +=
+            sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER) + bmp_stride(job->width, 24) * job->height;
+        metrics_add(&job->metrics, STAGE_PREVIEW, start);
+        job->status = JOB_DONE;
+    }
+    if (job->status == JOB_TRANSFORMED && options.spectrum_bmp) {
+        double start = metrics_clock();
+        printf("Gerando .bmp do espectro do arquivo: %s\n", job->input_file);
+        write_spectrum_bmp(ws, job->spectrum_name, job->spectra, job->width, job->height);
+        job->metrics.bytes_written +=
+            sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER) + bmp_stride(job->width, 24) * job->height;
+        metrics_add(&job->metrics, STAGE_PREVIEW, start);
+        job->status = JOB_DONE;
+    }
+    if (job->status == JOB_TRANSFORMED) {
+        if (options.channel_bmps) {
+            double start = metrics_clock();
+            printf("Gerando .bmp do arquivo: %s\n", job->input_file);
+            for (int c = 0; c < 3; c++) {
+                write_channel_bmp(job->preview_names[c], job->channels[c], c, job->width, job->height);
+            }
+            job->metrics.bytes_written += 3 * (sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER) +
+                                               bmp_stride(job->width, 24) * job->height);
+            metrics_add(&job->metrics, STAGE_PREVIEW, start);
+        }
+
+        printf("Gerando .DAT do arquivo: %s\n", job->input_file);
+        unsigned allocations = ws->allocations;
+        for (int c = 0; c < 3; c++) {
+            save_spectrum(ws, job->spectra[c], job->width, job->height, &job->outputs[c]);
+        }
+        job->metrics.allocations += ws->allocations - allocations;
+        job->status = JOB_DONE;
+    }
+    if (job->status == JOB_DONE) {
+        metrics_record(job->input_file, job->image_index, job->width, job->height, &job->metrics);
+        manifest_record(job->image_index);
+    }
+    if (job->reserved) {
+        // os buffers da imagem saem da memória junto com a reserva
+        workspace_trim(ws);
+        workspace_trim(job->buffers);
+        memory_release(job->reserved);
+        job->reserved = 0;
+    }
+}
+
+// Processa uma imagem inteira na thread atual, passando pelos três estágios
+static void extract_channels(const char *input_file, int image_index, Workspace *ws) {
+    ImageJob job;
+    job.buffers = ws;
+    if (load_image(&job, input_file, image_index) == 0) {
+        transform_image(&job, ws);
+        write_image(&job, ws);
+    }
+}
+
+// Imagens de um diretório, em ordem alfabética
+typedef struct {
+    char **files;
+    int count;
+    const char *unchanged; // imagens que o manifesto dispensa (NULL = nenhuma)
+    const int *indices;    // índice de cada imagem nas saídas (NULL = posição + 1)
+} WorkQueue;
+
+static int queue_index(const WorkQueue *queue, int i) {
+    return queue->indices ? queue->indices[i] : i + 1;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Pede ao sistema para começar a ler um arquivo que será aberto em breve
+static void prefetch_file(const char *filename) {
+#if !defined(_WIN32) && defined(POSIX_FADV_WILLNEED)
+    int fd = open(filename, O_RDONLY);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+#else
+    (void)filename;
+#endif
+}
+
+// Fila de jobs entre dois estágios. Comporta todos os jobs existentes, então
+// só quem retira espera; a retirada devolve NULL quando a fila está vazia e
+// todos os produtores terminaram.
+typedef struct {
+    ImageJob **items;
+    int capacity;
+    int head;
+    int count;
+    int producers;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} JobQueue;
+
+static int job_queue_init(JobQueue *queue, int capacity, int producers) {
+    queue->items = malloc(capacity * sizeof(ImageJob *));
+    queue->capacity = capacity;
+    queue->head = 0;
+    queue->count = 0;
+    queue->producers = producers;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+    return queue->items ? 0 : -1;
+}
+
+static void job_queue_destroy(JobQueue *queue) {
+    free(queue->items);
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->changed);
+}
+
+static void job_queue_push(JobQueue *queue, ImageJob *job) {
+    pthread_mutex_lock(&queue->lock);
+    queue->items[(queue->head + queue->count++) % queue->capacity] = job;
+    pthread_cond_signal(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static ImageJob *job_queue_pop(JobQueue *queue) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0 && queue->producers > 0) {
+        pthread_cond_wait(&queue->changed, &queue->lock);
+    }
+    ImageJob *job = NULL;
+    if (queue->count > 0) {
+        job = queue->items[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return job;
+}
+
+// Um produtor terminou; com o último, quem espera na fila vazia é liberado
+static void job_queue_done(JobQueue *queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->producers--;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// Processamento de um lote em três estágios ligados por filas: leitura (na
+// thread que chama), cálculo (options.jobs threads) e escrita (outras
+// options.jobs threads). Só existem depth jobs: quando todos estão em uso,
+// a leitura espera um voltar da escrita, o que limita a memória do lote.
+typedef struct {
+    WorkQueue *files;
+    JobQueue free_jobs;   // jobs livres, devolvidos pela escrita
+    JobQueue decoded;     // leitura -> cálculo
+    JobQueue transformed; // cálculo -> escrita
+} Pipeline;
+
+static void *compute_stage(void *arg) {
+    Pipeline *pipeline = arg;
+    Workspace ws = {0}; // scratch e pool próprios da thread
+    ImageJob *job;
+    while ((job = job_queue_pop(&pipeline->decoded)) != NULL) {
+        transform_image(job, &ws);
+        if (options.memory_budget) {
+            // o scratch não pode continuar ocupando memória depois que a
+            // imagem devolver a sua reserva
+            workspace_trim(&ws);
+        }
+        job_queue_push(&pipeline->transformed, job);
+    }
+    workspace_free(&ws);
+    job_queue_done(&pipeline->transformed);
+    return NULL;
+}
+
+static void *write_stage(void *arg) {
+    Pipeline *pipeline = arg;
+    Workspace ws = {0}; // espectro completo (--full-spectrum)
+    ImageJob *job;
+    while ((job = job_queue_pop(&pipeline->transformed)) != NULL) {
+        write_image(job, &ws);
+        job_queue_push(&pipeline->free_jobs, job);
+    }
+    workspace_free(&ws);
+    return NULL;
+}
+
+static void read_stage(Pipeline *pipeline) {
+    WorkQueue *files = pipeline->files;
+    for (int i = 0; i < files->count; i++) {
+        if (files->unchanged && files->unchanged[i]) {
+            continue;
+        }
+        // o sistema começa a ler o arquivo enquanto esperamos um job livre
+        prefetch_file(files->files[i]);
+        ImageJob *job = job_queue_pop(&pipeline->free_jobs);
+
+        printf("Processando arquivo: %s\n", files->files[i]);
+        if (load_image(job, files->files[i], queue_index(files, i)) == 0) {
+            job_queue_push(&pipeline->decoded, job);
+        } else {
+            job_queue_push(&pipeline->free_jobs, job);
+        }
+    }
+    job_queue_done(&pipeline->decoded);
+}
+
+static int start_threads(pthread_t *threads, int count, void *(*stage)(void *), void *arg) {
+    int started = 0;
+    for (; started < count; started++) {
+        if (pthread_create(&threads[started], NULL, stage, arg) != 0) {
+            perror("Erro ao criar thread");
+            break;
+        }
+    }
+    return started;
+}
+
+// Executa o lote no pipeline; retorna -1 se ele não pôde ser montado
+static int run_pipeline(WorkQueue *files) {
+    int jobs = options.jobs;
+    int depth = options.queue_depth ? options.queue_depth : jobs + 2;
+    Pipeline pipeline;
+    pipeline.files = files;
+
+    ImageJob *slots = calloc(depth, sizeof(ImageJob));
+    Workspace *buffers = calloc(depth, sizeof(Workspace));
+    pthread_t *threads = malloc(2 * jobs * sizeof(pthread_t));
+    int ok = slots && buffers && threads;
+    ok = job_queue_init(&pipeline.free_jobs, depth, 1) == 0 && ok;
+    ok = job_queue_init(&pipeline.decoded, depth, 1) == 0 && ok;
+    ok = job_queue_init(&pipeline.transformed, depth, 0) == 0 && ok;
+
+    int computers = 0;
+    int writers = 0;
+    if (ok) {
+        for (int i = 0; i < depth; i++) {
+            slots[i].buffers = &buffers[i];
+            job_queue_push(&pipeline.free_jobs, &slots[i]);
+        }
+        computers = start_threads(threads, jobs, compute_stage, &pipeline);
+        // a escrita só pode começar a esperar depois de saber quantos produtores tem
+        pipeline.transformed.producers = computers;
+        writers = computers ? start_threads(threads + computers, jobs, write_stage, &pipeline) : 0;
+    }
+
+    if (writers > 0) {
+        read_stage(&pipeline);
+    } else {
+        job_queue_done(&pipeline.decoded); // libera o cálculo já iniciado, sem imagens
+    }
+    for (int i = 0; i < computers + writers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (buffers) {
+        for (int i = 0; i < depth; i++) {
+            workspace_free(&buffers[i]);
+        }
+    }
+    free(buffers);
+    free(slots);
+    free(threads);
+    job_queue_destroy(&pipeline.free_jobs);
+    job_queue_destroy(&pipeline.decoded);
+    job_queue_destroy(&pipeline.transformed);
+    return writers > 0 ? 0 : -1;
+}
+
+static PROGRAM_ONLY void process_images_in_directory(const char *directory) {
+    if (options.archive_path) {
+        // todos os espectros vão para um único arquivo, sem .txt nem prévias
+        if (archive_open(options.archive_path) != 0) {
+            return;
+        }
+    } else {
+        if (filter_count) {
+            ensure_directory_exists("output_filtered");
+        } else if (match_kernel.mode == MATCH_CONVOLVE) {
+            ensure_directory_exists("output_convolved");
+        } else if (options.spectrum_bmp) {
+            ensure_directory_exists("output_spectrum");
+        } else if (match_kernel.mode == MATCH_NONE) {
+            ensure_directory_exists("output_fft_DAT");
+            ensure_directory_exists("output_fft_TXT");
+            if (options.channel_bmps) {
+                ensure_directory_exists("output_channels");
+            }
+        }
+    }
+    struct dirent *entry;
+    DIR *dp = opendir(directory);
+
+    if (dp == NULL) {
+        perror("Erro ao abrir diretório");
+        archive_close();
+        return;
+    }
+
+    WorkQueue queue = {NULL, 0, NULL, NULL};
+    int capacity = 0;
+    while ((entry = readdir(dp)) != NULL) {
+        if (entry->d_type == DT_REG && strstr(entry->d_name, ".bmp")) {
+            char input_file[MAX_FILENAME_LENGTH];
+            snprintf(input_file, sizeof(input_file), "%s/%s", directory, entry->d_name);
+            if (queue.count == capacity) {
+                capacity = capacity ? 2 * capacity : 64;
+                char **files = realloc(queue.files, capacity * sizeof(char *));
+                if (!files) {
+                    perror("Erro ao alocar lista de arquivos");
+                    break;
+                }
+                queue.files = files;
+            }
+            queue.files[queue.count++] = strdup(input_file);
+        } else {
+            printf("Arquivo ignorado: %s\n", entry->d_name);
+        }
+    }
+    closedir(dp);
+
+    // a ordem alfabética define o índice de cada imagem nos arquivos de saída,
+    // a menos que o manifesto já tenha dado um índice a ela
+    qsort(queue.files, queue.count, sizeof(char *), compare_names);
+
+    char *unchanged = NULL;
+    int *indices = NULL;
+    if (options.manifest_path && queue.count > 0) {
+        unchanged = calloc(queue.count, 1);
+        indices = malloc(queue.count * sizeof(int));
+        if (unchanged && indices) {
+            manifest_plan(queue.files, queue.count, unchanged, indices);
+            queue.unchanged = unchanged;
+            queue.indices = indices;
+        }
+    }
+
+    if (queue.count > 0 && run_pipeline(&queue) != 0) {
+        // sem threads: cada imagem passa pelos três estágios em sequência
+        Workspace ws = {0};
+        for (int i = 0; i < queue.count; i++) {
+            if (unchanged && unchanged[i]) {
+                continue;
+            }
+            printf("Processando arquivo: %s\n", queue.files[i]);
+            extract_channels(queue.files[i], queue_index(&queue, i), &ws);
+        }
+        workspace_free(&ws);
+    }
+
+    if (options.manifest_path) {
+        manifest_save(options.manifest_path);
+    }
+    for (int i = 0; i < queue.count; i++) {
+        free(queue.files[i]);
+    }
+    free(queue.files);
+    free(unchanged);
+    free(indices);
+    archive_close();
+}
+
+// Modo de medição (--bench): gera BMPs sintéticos numa matriz de tamanhos e
+// cronometra cada estágio do processamento de uma imagem. O BMP acabou de
+// ser gravado, então a leitura mede o arquivo já no cache do sistema.
+// Vale o menor tempo de options.bench_repeat medições de cada estágio.
+
+// potências de dois, tamanhos ímpares (Bluestein em 1021x769) e uma grande
+#define BENCH_DEFAULT_SIZES "256x256,1024x1024,2048x2048,1000x1000,1021x769,4096x4096"
+
+enum {
+    BENCH_READ,  // abrir o BMP e trazer todas as páginas
+    BENCH_SPLIT, // separar os canais nos planos da FFT
+    BENCH_FFT,
+    BENCH_DAT,
+    BENCH_TXT,
+    BENCH_BMP,   // prévias dos canais
+    BENCH_STAGES
+};
+
+static const char *const bench_stage_names[BENCH_STAGES] = {"read", "split", "fft", "dat", "txt", "bmp"};
+
+static double file_bytes(const char *filename) {
+    struct stat st;
+    return stat(filename, &st) == 0 ? (double)st.st_size : 0.0;
+}
+
+// Imagem sintética: gradientes com ruído, para que o espectro não seja trivial
+static void bench_write_image(const char *filename, int width, int height) {
+    RGB *pixels = malloc((size_t)width * height * sizeof(RGB));
+    if (!pixels) {
+        perror("Erro ao alocar imagem sintetica");
+        return;
+    }
+    uint32_t state = 2463534242u; // xorshift32: a mesma imagem em toda execução
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            RGB *pixel = &pixels[(size_t)y * width + x];
+            pixel->red = (uint8_t)((x * 255 / width) ^ (state & 0x1F));
+            pixel->green = (uint8_t)((y * 255 / height) ^ ((state >> 8) & 0x1F));
+            pixel->blue = (uint8_t)(((x + y) & 0xFF) ^ ((state >> 16) & 0x1F));
+        }
+    }
+    write_bmp(filename, pixels, width, height);
+    free(pixels);
+}
+
+// Mede um tamanho e grava uma linha de resultado por estágio
+static int bench_size(FILE *results, Workspace *ws, int width, int height) {
+    char bmp_name[MAX_FILENAME_LENGTH];
+    char dat_name[MAX_FILENAME_LENGTH];
+    char txt_name[MAX_FILENAME_LENGTH];
+    char preview_name[MAX_FILENAME_LENGTH];
+    snprintf(bmp_name, sizeof(bmp_name), "%s/imgfourier_bench.bmp", options.scratch_dir);
+    snprintf(dat_name, sizeof(dat_name), "%s/imgfourier_bench.dat", options.scratch_dir);
+    snprintf(txt_name, sizeof(txt_name), "%s/imgfourier_bench.txt", options.scratch_dir);
+    snprintf(preview_name, sizeof(preview_name), "%s/imgfourier_bench_canal.bmp", options.scratch_dir);
+
+    size_t N = (size_t)width * height;
+    size_t half_len = (size_t)(width / 2 + 1) * height;
+    fft_real *planes = workspace_get(ws, WS_INPUT, 3 * N * sizeof(fft_real));
+    Complex *spectrum = workspace_get(ws, WS_SPECTRUM, 3 * half_len * sizeof(Complex));
+    if (!planes || !spectrum) {
+        perror("Erro ao alocar memoria para a medicao");
+        return -1;
+    }
+    fft_real *channels[3] = {planes, planes + N, planes + 2 * N};
+    Complex *spectra[3] = {spectrum, spectrum + half_len, spectrum + 2 * half_len};
+    SpectrumSettings settings = program_spectrum_settings();
+
+    printf("Medindo %dx%d\n", width, height);
+    bench_write_image(bmp_name, width, height);
+    if (options.wisdom_path) {
+        // ajuste fora das medições, sobre planos zerados
+        memset(planes, 0, 3 * N * sizeof(fft_real));
+        wisdom_tune(ws, channels, spectra, width, height);
+    }
+
+    double best[BENCH_STAGES];
+    double bytes[BENCH_STAGES] = {0};
+    for (int stage = 0; stage < BENCH_STAGES; stage++) {
+        best[stage] = HUGE_VAL;
+    }
+
+    int status = 0;
+    for (int r = 0; r < options.bench_repeat && status == 0; r++) {
+        double t[BENCH_STAGES + 1];
+        BmpImage img;
+        t[BENCH_READ] = now_seconds();
+        if (bmp_open(bmp_name, &img) != 0) {
+            status = -1;
+            break;
+        }
+        volatile uint8_t touched = 0;
+        for (size_t offset = 0; offset < img.size; offset += 4096) {
+            touched += img.data[offset];
+        }
+        (void)touched;
+
+        t[BENCH_SPLIT] = now_seconds();
+        for (int y = 0; y < height; y++) {
+            size_t offset = (size_t)y * width;
+            bmp_decode_row(&img, y, channels[CHANNEL_RED] + offset, channels[CHANNEL_GREEN] + offset,
+                           channels[CHANNEL_BLUE] + offset);
+        }
+        bytes[BENCH_READ] = (double)img.size;
+        bytes[BENCH_SPLIT] = (double)img.size + 3.0 * N * sizeof(fft_real);
+        bmp_close(&img);
+
+        t[BENCH_FFT] = now_seconds();
+        if (transform_channels(ws, channels, spectra, width, height) != 0) {
+            status = -1;
+            break;
+        }
+
+        t[BENCH_DAT] = now_seconds();
+        bytes[BENCH_DAT] = 0;
+        for (int c = 0; c < 3; c++) {
+            SpectrumOutput output = {c, 1, bmp_name, dat_name, NULL, NULL, &settings};
+            save_spectrum(ws, spectra[c], width, height, &output);
+            bytes[BENCH_DAT] += file_bytes(dat_name);
+        }
+
+        t[BENCH_TXT] = now_seconds();
+        bytes[BENCH_TXT] = 0;
+        for (int c = 0; c < 3; c++) {
+            SpectrumOutput output = {c, 1, bmp_name, NULL, txt_name, NULL, &settings};
+            save_spectrum(ws, spectra[c], width, height, &output);
+            bytes[BENCH_TXT] += file_bytes(txt_name);
+        }
+
+        t[BENCH_BMP] = now_seconds();
+        bytes[BENCH_BMP] = 0;
+        for (int c = 0; c < 3; c++) {
+            write_channel_bmp(preview_name, channels[c], c, width, height);
+            bytes[BENCH_BMP] += file_bytes(preview_name);
+        }
+        t[BENCH_STAGES] = now_seconds();
+
+        for (int stage = 0; stage < BENCH_STAGES; stage++) {
+            double elapsed = t[stage + 1] - t[stage];
+            if (elapsed < best[stage]) {
+                best[stage] = elapsed;
+            }
+        }
+    }
+    remove(bmp_name);
+    remove(dat_name);
+    remove(txt_name);
+    remove(preview_name);
+    if (status != 0) {
+        fprintf(stderr, "Falha ao medir %dx%d\n", width, height);
+        return status;
+    }
+
+    // FFT real 2D: cerca de 2.5 N log2 N operações por canal
+    double flops = 3 * 2.5 * N * log2((double)N);
+    printf("%-6s %12s %12s %10s %10s\n", "etapa", "ms", "ns/ponto", "GFLOPS", "GB/s");
+    for (int stage = 0; stage < BENCH_STAGES; stage++) {
+        double seconds = best[stage];
+        double ns_per_point = seconds * 1e9 / N;
+        fprintf(results, "{\"width\": %d, \"height\": %d, \"stage\": \"%s\", \"seconds\": %.9f, \"ns_per_point\": %.4f",
+                width, height, bench_stage_names[stage], seconds, ns_per_point);
+        if (stage == BENCH_FFT) {
+            double gflops = flops / seconds * 1e-9;
+            printf("%-6s %12.3f %12.3f %10.3f %10s\n", bench_stage_names[stage], seconds * 1e3, ns_per_point, gflops, "-");
+            fprintf(results, ", \"gflops\": %.4f", gflops);
+        } else {
+            double gbytes = bytes[stage] / seconds * 1e-9;
+            printf("%-6s %12.3f %12.3f %10s %10.3f\n", bench_stage_names[stage], seconds * 1e3, ns_per_point, "-", gbytes);
+            fprintf(results, ", \"bytes\": %.0f, \"gbytes_per_second\": %.4f", bytes[stage], gbytes);
+        }
+        fprintf(results, ", \"threads\": %d, \"kernel\": \"%s\", \"precision\": \"%s\", \"pack_channels\": %d, \"full_spectrum\": %d, \"repeat\": %d}\n",
+                options.threads, select_radix4_kernel()->name, FFT_PRECISION_NAME, options.pack_channels,
+                options.full_spectrum, options.bench_repeat);
+    }
+    fflush(results);
+    return 0;
+}
+
+// Lê o próximo "LxA" da lista; retorna o resto dela ou NULL se for inválido
+static const char *parse_bench_size(const char *p, int *width, int *height) {
+    int length;
+    if (sscanf(p, "%dx%d%n", width, height, &length) != 2 || *width < 1 || *height < 1 ||
+        (p[length] != ',' && p[length] != '\0')) {
+        fprintf(stderr, "Tamanho invalido em --bench-sizes: %s\n", p);
+        return NULL;
+    }
+    return p[length] == ',' ? p + length + 1 : p + length;
+}
+
+static PROGRAM_ONLY int run_benchmark(void) {
+    const char *sizes = options.bench_sizes ? options.bench_sizes : BENCH_DEFAULT_SIZES;
+    int width, height;
+    // confere a lista inteira antes de começar a medir
+    for (const char *p = sizes; *p;) {
+        if (!(p = parse_bench_size(p, &width, &height))) {
+            return -1;
+        }
+    }
+
+    FILE *results = fopen(options.bench_output, "w");
+    if (!results) {
+        perror("Erro ao criar arquivo de resultados");
+        return -1;
+    }
+    Workspace ws = {0};
+    int status = 0;
+    for (const char *p = sizes; *p && status == 0;) {
+        p = parse_bench_size(p, &width, &height);
+        status = bench_size(results, &ws, width, height);
+    }
+    workspace_free(&ws);
+    fclose(results);
+    if (status == 0) {
+        printf("Resultados gravados em %s\n", options.bench_output);
+    }
+    return status;
+}
+
+// Verificação de precisão (--check-accuracy): a FFT, na precisão com que o
+// programa foi compilado, é comparada com uma DFT direta em long double sobre
+// amostras aleatórias de 8 bits, para cada tipo de plano (radix-4, radix
+// misto, Bluestein, entrada real) e para as transformadas 2D. Os erros são
+// relativos: o máximo à maior magnitude da referência e o RMS à sua energia.
+#define ACCURACY_TOLERANCE (sizeof(fft_real) == sizeof(float) ? 1e-5 : 1e-12) // RMS relativo aceito
+
+static uint32_t accuracy_random(uint32_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+// DFT direta de n pontos, com os fatores de giro tabelados em long double
+static int reference_dft(const long double *in_re, const long double *in_im, long double *out_re,
+                         long double *out_im, int n, int inverse) {
+    long double *table = malloc(2 * (size_t)n * sizeof(long double));
+    if (!table) {
+        return -1;
+    }
+    const long double pi = 3.141592653589793238462643383279502884L;
+    for (int k = 0; k < n; k++) {
+        table[2 * k] = cosl(2 * pi * k / n);
+        table[2 * k + 1] = (inverse ? 1 : -1) * sinl(2 * pi * k / n);
+    }
+    for (int k = 0; k < n; k++) {
+        long double re = 0, im = 0;
+        for (int j = 0; j < n; j++) {
+            size_t t = (size_t)j * k % n;
+            re += in_re[j] * table[2 * t] - in_im[j] * table[2 * t + 1];
+            im += in_re[j] * table[2 * t + 1] + in_im[j] * table[2 * t];
+        }
+        out_re[k] = re;
+        out_im[k] = im;
+    }
+    free(table);
+    return 0;
+}
+
+// DFT 2D direta, linha a linha e depois coluna a coluna; re e im (height x
+// width) são substituídos pelo resultado
+static int reference_dft2d(long double *re, long double *im, int width, int height) {
+    int longest = width > height ? width : height;
+    long double *buffer = malloc(4 * (size_t)longest * sizeof(long double));
+    if (!buffer) {
+        return -1;
+    }
+    long double *a_re = buffer, *a_im = buffer + longest, *b_re = buffer + 2 * longest, *b_im = buffer + 3 * longest;
+    int status = 0;
+    for (int y = 0; y < height && status == 0; y++) {
+        size_t row = (size_t)y * width;
+        status = reference_dft(re + row, im + row, b_re, b_im, width, 0);
+        memcpy(re + row, b_re, width * sizeof(long double));
+        memcpy(im + row, b_im, width * sizeof(long double));
+    }
+    for (int x = 0; x < width && status == 0; x++) {
+        for (int y = 0; y < height; y++) {
+            a_re[y] = re[(size_t)y * width + x];
+            a_im[y] = im[(size_t)y * width + x];
+        }
+        status = reference_dft(a_re, a_im, b_re, b_im, height, 0);
+        for (int y = 0; y < height; y++) {
+            re[(size_t)y * width + x] = b_re[y];
+            im[(size_t)y * width + x] = b_im[y];
+        }
+    }
+    free(buffer);
+    return status;
+}
+
+// Acumula a diferença entre um valor calculado e a referência
+typedef struct {
+    long double max_diff;
+    long double max_ref;
+    long double diff2;
+    long double ref2;
+} AccuracyError;
+
+static void accuracy_add(AccuracyError *error, long double re, long double im, long double ref_re,
+                         long double ref_im) {
+    long double diff = hypotl(re - ref_re, im - ref_im);
+    long double ref = hypotl(ref_re, ref_im);
+    error->max_diff = diff > error->max_diff ? diff : error->max_diff;
+    error->max_ref = ref > error->max_ref ? ref : error->max_ref;
+    error->diff2 += diff * diff;
+    error->ref2 += ref * ref;
+}
+
+static int accuracy_report(const char *name, int width, int height, const AccuracyError *error) {
+    double max = error->max_ref > 0 ? (double)(error->max_diff / error->max_ref) : 0.0;
+    double rms = error->ref2 > 0 ? (double)sqrtl(error->diff2 / error->ref2) : 0.0;
+    int ok = rms <= ACCURACY_TOLERANCE;
+    char size[32];
+    if (height > 1) {
+        snprintf(size, sizeof(size), "%dx%d", width, height);
+    } else {
+        snprintf(size, sizeof(size), "%d", width);
+    }
+    printf("%-12s %-10s erro maximo %.3e  RMS %.3e  %s\n", name, size, max, rms, ok ? "ok" : "FALHOU");
+    return ok ? 0 : -1;
+}
+
+// FFT complexa e de entrada real de n pontos contra a DFT direta
+static int check_fft_1d(int n, uint32_t *seed) {
+    long double *ref = malloc(4 * (size_t)n * sizeof(long double));
+    Complex *x = malloc(n * sizeof(Complex));
+    fft_real *samples = malloc(n * sizeof(fft_real));
+    FFTPlan *plan = get_fft_plan(n);
+    FFTPlan *real_plan = get_real_fft_plan(n);
+    size_t work_len = plan && real_plan ? max_size(plan->work_len, real_plan->work_len) : 0;
+    Complex *work = malloc((work_len ? work_len : 1) * sizeof(Complex));
+    int status = -1;
+    if (!ref || !x || !samples || !plan || !real_plan || !work) {
+        perror("Erro ao alocar memoria para a verificacao");
+        goto done;
+    }
+    static const char *const kinds[] = {"radix-4", "radix misto", "Bluestein"};
+    long double *in_re = ref, *in_im = ref + n, *out_re = ref + 2 * n, *out_im = ref + 3 * n;
+
+    // complexa
+    for (int k = 0; k < n; k++) {
+        x[k].real = accuracy_random(seed) & 0xFF;
+        x[k].imag = accuracy_random(seed) & 0xFF;
+        in_re[k] = x[k].real;
+        in_im[k] = x[k].imag;
+    }
+    if (reference_dft(in_re, in_im, out_re, out_im, n, 0) != 0) {
+        goto done;
+    }
+    fft_execute(plan, x, work);
+    AccuracyError error = {0, 0, 0, 0};
+    for (int k = 0; k < n; k++) {
+        accuracy_add(&error, x[k].real, x[k].imag, out_re[k], out_im[k]);
+    }
+    status = accuracy_report(kinds[plan->kind], n, 1, &error);
+
+    // entrada real: só os n/2 + 1 coeficientes gravados
+    for (int k = 0; k < n; k++) {
+        samples[k] = accuracy_random(seed) & 0xFF;
+        in_re[k] = samples[k];
+        in_im[k] = 0;
+    }
+    if (reference_dft(in_re, in_im, out_re, out_im, n, 0) != 0) {
+        status = -1;
+        goto done;
+    }
+    fft_execute_r2c(real_plan, samples, x, work);
+    AccuracyError real_error = {0, 0, 0, 0};
+    for (int k = 0; k <= n / 2; k++) {
+        accuracy_add(&real_error, x[k].real, x[k].imag, out_re[k], out_im[k]);
+    }
+    status |= accuracy_report("real", n, 1, &real_error);
+
+done:
+    free(ref);
+    free(x);
+    free(samples);
+    free(work);
+    return status;
+}
+
+// FFT 2D de entrada real (a das imagens) contra a DFT direta, e a volta pela
+// inversa, que deve reproduzir as amostras
+static int check_fft_2d(int width, int height, uint32_t *seed) {
+    size_t N = (size_t)width * height;
+    size_t half = width / 2 + 1;
+    size_t scratch_len = fft2d_r2c_scratch_len(width, height);
+    long double *ref = malloc(2 * N * sizeof(long double));
+    fft_real *samples = malloc(N * sizeof(fft_real));
+    fft_real *back = malloc(N * sizeof(fft_real));
+    Complex *spectrum = malloc(half * height * sizeof(Complex));
+    Complex *scratch = scratch_len ? malloc(scratch_len * sizeof(Complex)) : NULL;
+    int status = -1;
+    if (!ref || !samples || !back || !spectrum || !scratch) {
+        perror("Erro ao alocar memoria para a verificacao");
+        goto done;
+    }
+    long double *re = ref, *im = ref + N;
+    for (size_t i = 0; i < N; i++) {
+        samples[i] = accuracy_random(seed) & 0xFF;
+        re[i] = samples[i];
+        im[i] = 0;
+    }
+    if (reference_dft2d(re, im, width, height) != 0 || fft2d_r2c(samples, spectrum, scratch, width, height) != 0) {
+        goto done;
+    }
+    AccuracyError error = {0, 0, 0, 0};
+    for (int v = 0; v < height; v++) {
+        for (size_t u = 0; u < half; u++) {
+            const Complex *value = &spectrum[v * half + u];
+            accuracy_add(&error, value->real, value->imag, re[(size_t)v * width + u], im[(size_t)v * width + u]);
+        }
+    }
+    status = accuracy_report("2D real", width, height, &error);
+
+    if (fft2d_c2r(spectrum, back, scratch, width, height) != 0) {
+        status = -1;
+        goto done;
+    }
+    AccuracyError round_trip = {0, 0, 0, 0};
+    for (size_t i = 0; i < N; i++) {
+        accuracy_add(&round_trip, back[i] / (long double)N, 0, samples[i], 0);
+    }
+    status |= accuracy_report("2D ida/volta", width, height, &round_trip);
+
+done:
+    free(ref);
+    free(samples);
+    free(back);
+    free(spectrum);
+    free(scratch);
+    return status;
+}
+
+static PROGRAM_ONLY int check_accuracy(void) {
+    // potências de 2 com log2 par e ímpar, fatores 2, 3, 5 e 7, e primos (Bluestein)
+    static const int sizes[] = {256, 512, 4096, 360, 1000, 2744, 97, 1021, 1022};
+    static const int sizes_2d[][2] = {{256, 192}, {600, 400}, {97, 61}};
+    uint32_t seed = 2463534242u;
+    int status = 0;
+    printf("Precisao da FFT: %s (tolerancia RMS %.0e)\n", FFT_PRECISION_NAME, ACCURACY_TOLERANCE);
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        status |= check_fft_1d(sizes[i], &seed);
+    }
+    for (size_t i = 0; i < sizeof(sizes_2d) / sizeof(sizes_2d[0]); i++) {
+        status |= check_fft_2d(sizes_2d[i][0], sizes_2d[i][1], &seed);
+    }
+    printf(status == 0 ? "Precisao dentro da tolerancia\n" : "Precisao FORA da tolerancia\n");
+    return status;
+}
+
+// Uso como biblioteca (imgFourier.h): um contexto faz o papel de um job do
+// pipeline junto com o workspace de cálculo, sem filas nem arquivos de saída
+struct ImgFourierContext {
+    Workspace ws;      // scratch da FFT e pool de threads
+    Workspace buffers; // planos de entrada e espectros (WS_INPUT, WS_SPECTRUM)
+    SpectrumSettings output; // gravação de imgfourier_save_spectrum, sem arquivo único nem mensagens
+    int width;         // 0 sem transformada válida
+    int height;
+    fft_real *planes[3];
+    Complex *spectra[3];
+};
+
+ImgFourierContext *imgfourier_create(int threads) {
+    ImgFourierContext *ctx = calloc(1, sizeof(ImgFourierContext));
+    if (!ctx) {
+        return NULL;
+    }
+    ctx->ws.threads = threads > 1 ? threads : 1;
+    ctx->output.dat_format = SPECTRUM_FLOAT64;
+    ctx->output.txt_precision = -1;
+    if (threads > 1) {
+        ctx->ws.pool = create_thread_pool(threads);
+        if (!ctx->ws.pool) {
+            free(ctx);
+            return NULL;
+        }
+    }
+    return ctx;
+}
+
+int imgfourier_set_output(ImgFourierContext *ctx, const ImgFourierOutput *output) {
+    // na ordem de IMGFOURIER_DAT_*
+    static const int formats[] = {SPECTRUM_FLOAT64, SPECTRUM_FLOAT32, SPECTRUM_FLOAT16, SPECTRUM_RAW};
+    if (output->dat_format < IMGFOURIER_DAT_F64 || output->dat_format > IMGFOURIER_DAT_RAW ||
+        output->txt_precision < -1 || output->txt_precision > 17) {
+        return -1;
+    }
+    ctx->output.full_spectrum = output->full_spectrum != 0;
+    ctx->output.dat_format = formats[output->dat_format];
+    ctx->output.txt_precision = output->txt_precision;
+    return 0;
+}
+
+void imgfourier_destroy(ImgFourierContext *ctx) {
+    if (ctx) {
+        workspace_free(&ctx->ws);
+        workspace_free(&ctx->buffers);
+        free(ctx);
+    }
+}
+
+// Planos e espectros para width x height, reaproveitando os buffers
+static int context_reserve(ImgFourierContext *ctx, int width, int height) {
+    size_t N = (size_t)width * height;
+    size_t half_len = (size_t)(width / 2 + 1) * height;
+    fft_real *planes = workspace_get(&ctx->buffers, WS_INPUT, 3 * N * sizeof(fft_real));
+    Complex *spectra = workspace_get(&ctx->buffers, WS_SPECTRUM, 3 * half_len * sizeof(Complex));
+    if (!planes || !spectra) {
+        perror("Erro ao alocar memoria para a FFT");
+        return -1;
+    }
+    for (int c = 0; c < 3; c++) {
+        ctx->planes[c] = planes + c * N;
+        ctx->spectra[c] = spectra + c * half_len;
+    }
+    return 0;
+}
+
+static int context_transform(ImgFourierContext *ctx, int width, int height) {
+    wisdom_tune(&ctx->ws, ctx->planes, ctx->spectra, width, height);
+    if (transform_channels(&ctx->ws, ctx->planes, ctx->spectra, width, height) != 0) {
+        return -1;
+    }
+    ctx->width = width;
+    ctx->height = height;
+    return 0;
+}
+
+static int context_transform_bmp(ImgFourierContext *ctx, BmpImage *img) {
+    int width = img->width;
+    int height = img->height;
+    int status = context_reserve(ctx, width, height);
+    for (int y = 0; y < height && status == 0; y++) {
+        size_t offset = (size_t)y * width;
+        bmp_decode_row(img, y, ctx->planes[CHANNEL_RED] + offset, ctx->planes[CHANNEL_GREEN] + offset,
+                       ctx->planes[CHANNEL_BLUE] + offset);
+    }
+    bmp_close(img);
+    return status == 0 ? context_transform(ctx, width, height) : -1;
+}
+
+// Em todas as entradas, uma falha também descarta o resultado anterior
+int imgfourier_transform_file(ImgFourierContext *ctx, const char *filename) {
+    BmpImage img;
+    ctx->width = ctx->height = 0;
+    if (bmp_open(filename, &img) != 0) {
+        return -1;
+    }
+    return context_transform_bmp(ctx, &img);
+}
+
+int imgfourier_transform_bmp(ImgFourierContext *ctx, const void *data, size_t size) {
+    BmpImage img;
+    ctx->width = ctx->height = 0;
+    if (bmp_open_memory(data, size, &img) != 0) {
+        return -1;
+    }
+    return context_transform_bmp(ctx, &img);
+}
+
+int imgfourier_transform_rgb(ImgFourierContext *ctx, const uint8_t *pixels, int width, int height, size_t stride) {
+    ctx->width = ctx->height = 0;
+    if (width <= 0 || height <= 0 || (uint64_t)width * height > INT32_MAX || stride < 3 * (size_t)width) {
+        fprintf(stderr, "Imagem RGB invalida: %dx%d\n", width, height);
+        return -1;
+    }
+    if (context_reserve(ctx, width, height) != 0) {
+        return -1;
+    }
+    // como nos planos lidos de um BMP, a linha 0 é a de baixo
+    for (int y = 0; y < height; y++) {
+        const uint8_t *row = pixels + (size_t)(height - 1 - y) * stride;
+        size_t offset = (size_t)y * width;
+        for (int x = 0; x < width; x++) {
+            ctx->planes[CHANNEL_RED][offset + x] = row[3 * x];
+            ctx->planes[CHANNEL_GREEN][offset + x] = row[3 * x + 1];
+            ctx->planes[CHANNEL_BLUE][offset + x] = row[3 * x + 2];
+        }
+    }
+    return context_transform(ctx, width, height);
+}
+
+const ImgFourierComplex *imgfourier_spectrum(const ImgFourierContext *ctx, int channel, int *width, int *height) {
+    if (!ctx->width || channel < CHANNEL_RED || channel > CHANNEL_BLUE) {
+        return NULL;
+    }
+    if (width) {
+        *width = ctx->width;
+    }
+    if (height) {
+        *height = ctx->height;
+    }
+    return ctx->spectra[channel];
+}
+
+int imgfourier_save_spectrum(ImgFourierContext *ctx, int channel, const char *dat_filename, const char *txt_filename) {
+    if (!ctx->width || channel < CHANNEL_RED || channel > CHANNEL_BLUE) {
+        return -1;
+    }
+    SpectrumOutput output = {channel, 0, "", dat_filename, txt_filename, NULL, &ctx->output};
+    return save_spectrum(&ctx->ws, ctx->spectra[channel], ctx->width, ctx->height, &output);
+}
+
+void imgfourier_release_plans(void) {
+    destroy_fft_plans();
+}
+
+#ifndef IMGFOURIER_NO_MAIN
+int main(int argc, char *argv[]) {
+    const char *kernel_path = NULL;
+    int kernel_mode = MATCH_NONE;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--full-spectrum") == 0) {
+            options.full_spectrum = 1;
+        } else if (strcmp(argv[i], "--pack-channels") == 0) {
+            options.pack_channels = 1;
+        } else if (strcmp(argv[i], "--no-channel-bmps") == 0) {
+            options.channel_bmps = 0;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            options.jobs = atoi(argv[++i]);
+            if (options.jobs < 1) {
+                fprintf(stderr, "Numero de threads invalido: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            if (parse_filter(argv[++i]) != 0) {
+                return 1;
+            }
+        } else if ((strcmp(argv[i], "--convolve") == 0 || strcmp(argv[i], "--correlate") == 0) && i + 1 < argc) {
+            if (kernel_path) {
+                fprintf(stderr, "Use so um --convolve ou --correlate\n");
+                return 1;
+            }
+            kernel_mode = strcmp(argv[i], "--convolve") == 0 ? MATCH_CONVOLVE : MATCH_CORRELATE;
+            kernel_path = argv[++i];
+        } else if (strcmp(argv[i], "--peaks") == 0 && i + 1 < argc) {
+            match_kernel.peaks = atoi(argv[++i]);
+            if (match_kernel.peaks < 1 || match_kernel.peaks > MAX_PEAKS) {
+                fprintf(stderr, "Numero de picos invalido (use 1 a %d): %s\n", MAX_PEAKS, argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            options.stats = 1;
+        } else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) {
+            options.metrics_path = argv[++i];
+            options.stats = 1;
+        } else if (strcmp(argv[i], "--spectrum-bmp") == 0) {
+            options.spectrum_bmp = 1;
+        } else if (strcmp(argv[i], "--manifest") == 0 && i + 1 < argc) {
+            options.manifest_path = argv[++i];
+        } else if (strcmp(argv[i], "--wisdom") == 0 && i + 1 < argc) {
+            options.wisdom_path = argv[++i];
+        } else if (strcmp(argv[i], "--check-accuracy") == 0) {
+            options.check_accuracy = 1;
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            options.bench = 1;
+        } else if (strcmp(argv[i], "--bench-sizes") == 0 && i + 1 < argc) {
+            options.bench_sizes = argv[++i];
+        } else if (strcmp(argv[i], "--bench-repeat") == 0 && i + 1 < argc) {
+            options.bench_repeat = atoi(argv[++i]);
+            if (options.bench_repeat < 1) {
+                fprintf(stderr, "Numero de repeticoes invalido: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--bench-output") == 0 && i + 1 < argc) {
+            options.bench_output = argv[++i];
+        } else if (strcmp(argv[i], "--queue-depth") == 0 && i + 1 < argc) {
+            options.queue_depth = atoi(argv[++i]);
+            if (options.queue_depth < 1) {
+                fprintf(stderr, "Profundidade de fila invalida: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            options.threads = atoi(argv[++i]);
+            if (options.threads < 1) {
+                fprintf(stderr, "Numero de threads invalido: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--memory-budget") == 0 && i + 1 < argc) {
+            long megabytes = atol(argv[++i]);
+            if (megabytes < 1) {
+                fprintf(stderr, "Orcamento de memoria invalido: %s\n", argv[i]);
+                return 1;
+            }
+            options.memory_budget = (size_t)megabytes << 20;
+        } else if (strcmp(argv[i], "--scratch-dir") == 0 && i + 1 < argc) {
+            options.scratch_dir = argv[++i];
+        } else if (strcmp(argv[i], "--txt-precision") == 0 && i + 1 < argc) {
+            options.txt_precision = atoi(argv[++i]);
+            if (options.txt_precision < 0 || options.txt_precision > 17) {
+                fprintf(stderr, "Precisao invalida (use 0 a 17): %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--dat-format") == 0 && i + 1 < argc) {
+            static const char *const formats[] = {"f64", "f32", "f16", "raw"};
+            const char *format = argv[++i];
+            int found = 0;
+            for (int k = 0; k < 4; k++) {
+                if (strcmp(format, formats[k]) == 0) {
+                    options.dat_format = k;
+                    found = 1;
+                }
+            }
+            if (!found) {
+                fprintf(stderr, "Formato de .dat desconhecido: %s\n", format);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--archive") == 0 && i + 1 < argc) {
+            options.archive_path = argv[++i];
+            options.channel_bmps = 0;
+        } else if (strcmp(argv[i], "--simd") == 0 && i + 1 < argc) {
+            const char *level = argv[++i];
+            int found = 0;
+            for (int k = 0; k < (int)(sizeof(radix4_kernels) / sizeof(radix4_kernels[0])); k++) {
+                if (strcmp(level, radix4_kernels[k].name) == 0) {
+                    options.simd_level = k;
+                    found = 1;
+                }
+            }
+            if (!found) {
+                fprintf(stderr, "Conjunto de instrucoes desconhecido: %s\n", level);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Opcao desconhecida: %s\n", argv[i]);
+            fprintf(stderr, "Uso: %s [-j N] [-t N] [--queue-depth N] [--full-spectrum] [--pack-channels] [--no-channel-bmps] [--memory-budget MB] [--scratch-dir DIR] [--txt-precision N] [--dat-format f64|f32|f16|raw] [--archive ARQUIVO] [--simd scalar|sse2|avx2|avx512] [--wisdom ARQUIVO] [--manifest ARQUIVO] [--filter TIPO:PARAMETROS] [--spectrum-bmp] [--convolve KERNEL.bmp | --correlate MODELO.bmp] [--peaks N] [--stats] [--metrics ARQUIVO] [--check-accuracy] [--bench] [--bench-sizes LxA,...] [--bench-repeat N] [--bench-output ARQUIVO]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if ((filter_count || kernel_path) && options.archive_path) {
+        fprintf(stderr, "--filter, --convolve e --correlate nao gravam espectros e nao podem ser usados com --archive\n");
+        return 1;
+    }
+    if (filter_count && kernel_path) {
+        fprintf(stderr, "--filter nao pode ser usado com --convolve ou --correlate\n");
+        return 1;
+    }
+    if (options.spectrum_bmp && (filter_count || kernel_path || options.archive_path)) {
+        fprintf(stderr, "--spectrum-bmp nao pode ser usado com --filter, --convolve, --correlate ou --archive\n");
+        return 1;
+    }
+    if (options.manifest_path && kernel_mode == MATCH_CORRELATE) {
+        fprintf(stderr, "--manifest nao pode ser usado com --correlate: os picos nao ficam gravados\n");
+        return 1;
+    }
+
+    printf("Kernel da FFT: %s (%s)\n", select_radix4_kernel()->name, FFT_PRECISION_NAME);
+    if (options.wisdom_path && wisdom_load(options.wisdom_path) != 0) {
+        return 1;
+    }
+
+    if (options.check_accuracy) {
+        int status = check_accuracy();
+        destroy_fft_plans();
+        return status == 0 ? 0 : 1;
+    }
+
+    // o espectro do kernel é calculado uma vez e vale para todas as imagens
+    if (kernel_path && match_kernel_load(kernel_path, kernel_mode) != 0) {
+        return 1;
+    }
+
+    if (options.bench) {
+        int status = run_benchmark();
+        if (options.wisdom_path) {
+            wisdom_save(options.wisdom_path);
+        }
+        destroy_fft_plans();
+        return status == 0 ? 0 : 1;
+    }
+
+    if (options.stats && metrics_open() != 0) {
+        return 1;
+    }
+    if (options.manifest_path && manifest_load(options.manifest_path) != 0) {
+        return 1;
+    }
+    process_images_in_directory("img");
+    metrics_finish();
+    if (options.wisdom_path) {
+        wisdom_save(options.wisdom_path);
+    }
+    match_kernel_free();
+    destroy_fft_plans();
     printf("Programa Concluído com sucesso!\n");
     return 0;
 }
+#endif
@@ -0,0 +1,86 @@
+// imgFourier como biblioteca: FFT 2D dos canais de cor de uma imagem, sem
+// main, sem diretórios fixos e sem índice global de imagem.
+//
+// Para usar, compile imgFourier.c com -DIMGFOURIER_NO_MAIN (e, se quiser, com
+// -DFFT_SINGLE_PRECISION, o mesmo para o código que inclui este cabeçalho) e
+// ligue com -lm -lpthread. Só as funções imgfourier_* são exportadas: o resto
+// de imgFourier.c é static e não conflita com nomes do programa que o usa.
+// imgFourierTeste.c confere o resultado com o .dat gravado pelo programa.
+//
+// Cada contexto guarda seus buffers (planos, espectros e trabalho da FFT),
+// que só crescem: imagens seguintes do mesmo tamanho, ou menores, não alocam
+// memória. Um contexto é usado por uma thread de cada vez; contextos
+// diferentes podem trabalhar em paralelo, compartilhando os planos de FFT.
+#ifndef IMGFOURIER_H
+#define IMGFOURIER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef FFT_SINGLE_PRECISION
+typedef float imgfourier_real;
+#else
+typedef double imgfourier_real;
+#endif
+
+typedef struct {
+    imgfourier_real real;
+    imgfourier_real imag;
+} ImgFourierComplex;
+
+// Canais, na ordem dos espectros
+enum {
+    IMGFOURIER_RED,
+    IMGFOURIER_GREEN,
+    IMGFOURIER_BLUE
+};
+
+typedef struct ImgFourierContext ImgFourierContext;
+
+// Cria um contexto cuja FFT é dividida entre threads threads (1 = só a
+// thread que chama); NULL se faltar memória
+ImgFourierContext *imgfourier_create(int threads);
+
+void imgfourier_destroy(ImgFourierContext *ctx);
+
+// Transformam uma imagem; 0 em caso de sucesso. O resultado substitui o da
+// imagem anterior do contexto.
+// BMP em disco (8, 24 ou 32 bpp, sem compressão)
+int imgfourier_transform_file(ImgFourierContext *ctx, const char *filename);
+// Conteúdo de um arquivo BMP já na memória (não é copiado nem modificado)
+int imgfourier_transform_bmp(ImgFourierContext *ctx, const void *data, size_t size);
+// Pixels RGB de 8 bits, linhas de cima para baixo com stride bytes cada
+int imgfourier_transform_rgb(ImgFourierContext *ctx, const uint8_t *pixels, int width, int height, size_t stride);
+
+// Meio espectro do canal na última transformada: height linhas de
+// width / 2 + 1 coeficientes, não normalizados. Válido até a próxima
+// transformada ou imgfourier_destroy; NULL se não houver imagem.
+const ImgFourierComplex *imgfourier_spectrum(const ImgFourierContext *ctx, int channel, int *width, int *height);
+
+// Formatos dos coeficientes no .dat
+enum {
+    IMGFOURIER_DAT_F64, // double
+    IMGFOURIER_DAT_F32,
+    IMGFOURIER_DAT_F16, // meia precisão, multiplicados por 1 / (width * height)
+    IMGFOURIER_DAT_RAW  // double, sem cabeçalho
+};
+
+// Como imgfourier_save_spectrum grava o espectro. O padrão de um contexto
+// novo é o do programa sem opções: {0, IMGFOURIER_DAT_F64, -1}.
+typedef struct {
+    int full_spectrum; // height x width coeficientes em vez do meio espectro
+    int dat_format;    // IMGFOURIER_DAT_*
+    int txt_precision; // casas decimais do .txt, 0 a 17 (-1 = menor representação exata)
+} ImgFourierOutput;
+
+// Troca o formato de gravação do contexto; -1 se algum campo for inválido
+int imgfourier_set_output(ImgFourierContext *ctx, const ImgFourierOutput *output);
+
+// Grava o espectro do canal no formato .dat e/ou .txt do programa (qualquer
+// um dos nomes pode ser NULL), sem escrever na saída padrão
+int imgfourier_save_spectrum(ImgFourierContext *ctx, int channel, const char *dat_filename, const char *txt_filename);
+
+// Libera os planos de FFT compartilhados, depois de destruir todos os contextos
+void imgfourier_release_plans(void);
+
+#endif
@@ -0,0 +1,95 @@
+// Teste da biblioteca (imgFourier.h): transforma um BMP carregado na memória
+// e confere se o .dat gravado por ela é idêntico, byte a byte, ao que o
+// programa gerou para a mesma imagem.
+//
+// Compilação e uso, com a saída do programa já em output_fft_DAT:
+//   gcc -O2 -DIMGFOURIER_NO_MAIN imgFourierTeste.c imgFourier.c -o imgFourierTeste -lm -lpthread
+//   ./imgFourier
+//   ./imgFourierTeste img/foto.bmp output_fft_DAT/red_channel_fft_01.dat
+//       "output_fft_DAT/green_channel _fft_01.dat" output_fft_DAT/blue_channel_fft_01.dat
+// (numa linha só; o índice 01 é o da imagem na ordem alfabética de img)
+// Retorna 0 se os três canais conferem.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "imgFourier.h"
+
+#define TEST_DAT "imgFourierTeste.dat" // .dat gravado pela biblioteca, apagado no fim
+
+// Lê um arquivo inteiro; NULL em caso de erro
+static unsigned char *read_file(const char *filename, size_t *size) {
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        perror(filename);
+        return NULL;
+    }
+    unsigned char *data = NULL;
+    if (fseek(fp, 0, SEEK_END) == 0) {
+        long length = ftell(fp);
+        rewind(fp);
+        data = length > 0 ? malloc(length) : NULL;
+        if (data && fread(data, 1, length, fp) != (size_t)length) {
+            free(data);
+            data = NULL;
+        }
+        *size = (size_t)length;
+    }
+    fclose(fp);
+    if (!data) {
+        fprintf(stderr, "Erro ao ler %s\n", filename);
+    }
+    return data;
+}
+
+// O .dat do canal gravado pela biblioteca é igual ao do programa?
+static int check_channel(ImgFourierContext *ctx, int channel, const char *expected_filename) {
+    static const char *const names[3] = {"vermelho", "verde", "azul"};
+    if (imgfourier_save_spectrum(ctx, channel, TEST_DAT, NULL) != 0) {
+        fprintf(stderr, "Canal %s: falha ao gravar o espectro\n", names[channel]);
+        return -1;
+    }
+    size_t size, expected_size;
+    unsigned char *data = read_file(TEST_DAT, &size);
+    unsigned char *expected = read_file(expected_filename, &expected_size);
+    int status = -1;
+    if (data && expected) {
+        if (size != expected_size) {
+            fprintf(stderr, "Canal %s: %zu bytes, esperados %zu\n", names[channel], size, expected_size);
+        } else if (memcmp(data, expected, size) != 0) {
+            size_t i = 0;
+            while (data[i] == expected[i]) {
+                i++;
+            }
+            fprintf(stderr, "Canal %s: difere de %s no byte %zu\n", names[channel], expected_filename, i);
+        } else {
+            printf("Canal %s: igual a %s\n", names[channel], expected_filename);
+            status = 0;
+        }
+    }
+    free(data);
+    free(expected);
+    remove(TEST_DAT);
+    return status;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 5) {
+        fprintf(stderr, "Uso: %s IMAGEM.bmp DAT_VERMELHO DAT_VERDE DAT_AZUL\n", argv[0]);
+        return 2;
+    }
+    size_t size;
+    unsigned char *bmp = read_file(argv[1], &size);
+    ImgFourierContext *ctx = imgfourier_create(1);
+    int status = bmp && ctx ? 0 : -1;
+    if (status == 0 && imgfourier_transform_bmp(ctx, bmp, size) != 0) {
+        fprintf(stderr, "Falha ao transformar %s\n", argv[1]);
+        status = -1;
+    }
+    for (int c = IMGFOURIER_RED; c <= IMGFOURIER_BLUE && status == 0; c++) {
+        status = check_channel(ctx, c, argv[2 + c]);
+    }
+    imgfourier_destroy(ctx);
+    imgfourier_release_plans();
+    free(bmp);
+    return status == 0 ? 0 : 1;
+}
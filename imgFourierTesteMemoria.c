@@ -0,0 +1,146 @@
+// Teste do orçamento de memória (--memory-budget): num diretório img com
+// quatro imagens que cabem no orçamento e uma que precisa ser transformada em
+// disco, o pico de memória residente do programa, com -j 1 e com -j 4, não
+// pode passar do orçamento mais uma folga fixa (o próprio programa, pilhas
+// das threads, planos da FFT).
+//
+// Compilação e uso (POSIX):
+//   gcc -O2 imgFourier.c -o imgFourier -lm -lpthread
+//   gcc -O2 imgFourierTesteMemoria.c -o imgFourierTesteMemoria
+//   ./imgFourierTesteMemoria ./imgFourier DIRETORIO
+// DIRETORIO é criado se não existir e recebe img e as saídas do programa.
+// Retorna 0 se as duas execuções ficam dentro do limite.
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define BUDGET_MB 40   // --memory-budget
+#define OVERHEAD_MB 6  // folga além do orçamento
+
+static const struct {
+    const char *name;
+    int width;
+    int height;
+} test_images[] = {
+    {"img/a.bmp", 640, 560},
+    {"img/b.bmp", 640, 560},
+    {"img/c.bmp", 640, 560},
+    {"img/d.bmp", 640, 560},
+    {"img/e.bmp", 2000, 1500}, // não cabe no orçamento: modo fora da memória
+};
+
+static void put_u16(unsigned char *p, unsigned value) {
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+}
+
+static void put_u32(unsigned char *p, uint32_t value) {
+    put_u16(p, value & 0xffff);
+    put_u16(p + 2, value >> 16);
+}
+
+// BMP de 24 bits com ruído pseudoaleatório, para o espectro não ser trivial
+static int write_test_bmp(const char *filename, int width, int height) {
+    size_t stride = ((size_t)width * 3 + 3) & ~(size_t)3;
+    unsigned char header[54] = {'B', 'M'};
+    put_u32(header + 2, (uint32_t)(sizeof(header) + stride * height));
+    put_u32(header + 10, sizeof(header));
+    put_u32(header + 14, 40);
+    put_u32(header + 18, width);
+    put_u32(header + 22, height);
+    put_u16(header + 26, 1);
+    put_u16(header + 28, 24);
+    put_u32(header + 34, (uint32_t)(stride * height));
+
+    FILE *fp = fopen(filename, "wb");
+    unsigned char *row = calloc(stride, 1);
+    int status = fp && row && fwrite(header, sizeof(header), 1, fp) == 1 ? 0 : -1;
+    uint32_t state = 12345;
+    for (int y = 0; y < height && status == 0; y++) {
+        for (size_t x = 0; x < (size_t)width * 3; x++) {
+            state = state * 1103515245 + 12345;
+            row[x] = (unsigned char)(state >> 16);
+        }
+        status = fwrite(row, stride, 1, fp) == 1 ? 0 : -1;
+    }
+    if (fp && fclose(fp) != 0) {
+        status = -1;
+    }
+    free(row);
+    if (status != 0) {
+        perror(filename);
+    }
+    return status;
+}
+
+// Roda o programa e devolve o pico de memória residente em KB (-1 se falhou)
+static long run_program(const char *program, const char *jobs) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (!freopen("/dev/null", "w", stdout)) {
+            _exit(127);
+        }
+        char budget[16];
+        snprintf(budget, sizeof(budget), "%d", BUDGET_MB);
+        execl(program, program, "-j", jobs, "--memory-budget", budget, "--no-channel-bmps", (char *)NULL);
+        perror(program);
+        _exit(127);
+    }
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "-j %s: o programa falhou\n", jobs);
+        return -1;
+    }
+    return usage.ru_maxrss;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "Uso: %s PROGRAMA DIRETORIO\n", argv[0]);
+        return 2;
+    }
+    char *program = realpath(argv[1], NULL);
+    if (!program) {
+        perror(argv[1]);
+        return 2;
+    }
+    if ((mkdir(argv[2], 0755) != 0 && errno != EEXIST) || chdir(argv[2]) != 0 ||
+        (mkdir("img", 0755) != 0 && errno != EEXIST)) {
+        perror(argv[2]);
+        free(program);
+        return 2;
+    }
+    for (size_t i = 0; i < sizeof(test_images) / sizeof(test_images[0]); i++) {
+        if (write_test_bmp(test_images[i].name, test_images[i].width, test_images[i].height) != 0) {
+            free(program);
+            return 2;
+        }
+    }
+
+    static const char *const jobs[] = {"1", "4"};
+    long limit = (BUDGET_MB + OVERHEAD_MB) * 1024L;
+    int failures = 0;
+    for (int i = 0; i < 2; i++) {
+        long peak = run_program(program, jobs[i]);
+        if (peak < 0 || peak > limit) {
+            failures++;
+        }
+        printf("-j %s: pico de %ld KB (limite %ld KB)%s\n", jobs[i], peak, limit,
+               peak >= 0 && peak <= limit ? "" : " FALHOU");
+    }
+    free(program);
+    return failures ? 1 : 0;
+}